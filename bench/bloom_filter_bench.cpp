@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include "bloom_filter.hpp"
+
+namespace psync {
+
+// args: projected element count, false positive rate * 1000
+static bloom_parameters
+makeParameters(const benchmark::State& state)
+{
+  bloom_parameters opt;
+  opt.projected_element_count = state.range(0);
+  opt.false_positive_probability = state.range(1)/1000.;
+  opt.compute_optimal_parameters();
+  return opt;
+}
+
+static void
+BloomArguments(benchmark::internal::Benchmark* b)
+{
+  for (int count : {100, 10000, 1000000}) {
+    for (int fp : {1, 10, 100}) {
+      b->Args({count, fp});
+    }
+  }
+}
+
+static void
+BM_BloomInsert(benchmark::State& state)
+{
+  bloom_filter bf(makeParameters(state));
+  std::size_t i = 0;
+
+  for (auto _ : state) {
+    bf.insert("/org/site/building/room/sensor-" + std::to_string(i++));
+  }
+}
+BENCHMARK(BM_BloomInsert)->Apply(BloomArguments);
+
+static void
+BM_BloomContains(benchmark::State& state)
+{
+  bloom_filter bf(makeParameters(state));
+  for (int64_t i = 0; i < state.range(0); i++) {
+    bf.insert("/org/site/building/room/sensor-" + std::to_string(i));
+  }
+
+  // half members, half non-members
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bf.contains("/org/site/building/room/sensor-" + std::to_string(i++ % (2*state.range(0)))));
+  }
+}
+BENCHMARK(BM_BloomContains)->Apply(BloomArguments);
+
+// what decoding the filter of a sync interest used to cost per interest
+static void
+BM_BloomParameters(benchmark::State& state)
+{
+  for (auto _ : state) {
+    bloom_filter bf(makeParameters(state));
+    benchmark::DoNotOptimize(bf.salts().data());
+  }
+}
+BENCHMARK(BM_BloomParameters)->Apply(BloomArguments);
+
+static void
+BM_BloomShape(benchmark::State& state)
+{
+  for (auto _ : state) {
+    bloom_filter bf(bloom_shape::get(state.range(0), state.range(1)));
+    benchmark::DoNotOptimize(bf.salts().data());
+  }
+}
+BENCHMARK(BM_BloomShape)->Apply(BloomArguments);
+
+}
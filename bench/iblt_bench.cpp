@@ -0,0 +1,123 @@
+#include <benchmark/benchmark.h>
+
+#include <thread>
+
+#include <ndn-cxx/name.hpp>
+
+#include "iblt.hpp"
+
+namespace psync {
+
+static const size_t EXPECTED_NUM_ENTRIES = 1000;
+
+static IBLT::Key
+makeKey(size_t i)
+{
+  return IBLT::makeKey("/org/site/building/room/sensor-" + std::to_string(i) + "/1");
+}
+
+static void
+BM_IbltInsert(benchmark::State& state)
+{
+  IBLT iblt(EXPECTED_NUM_ENTRIES);
+  size_t i = 0;
+
+  for (auto _ : state) {
+    iblt.insert(makeKey(i++));
+  }
+}
+BENCHMARK(BM_IbltInsert);
+
+static void
+BM_IbltSubtract(benchmark::State& state)
+{
+  IBLT a(state.range(0));
+  IBLT b(state.range(0));
+  for (int64_t i = 0; i < state.range(0); i++) {
+    a.insert(makeKey(i));
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a - b);
+  }
+}
+BENCHMARK(BM_IbltSubtract)->RangeMultiplier(10)->Range(100, 100000);
+
+// arg: size of the difference; the repo replies once it reaches half of
+// EXPECTED_NUM_ENTRIES and decoding starts failing above the table size
+static void
+BM_IbltListEntries(benchmark::State& state)
+{
+  IBLT repo(EXPECTED_NUM_ENTRIES);
+  IBLT consumer(EXPECTED_NUM_ENTRIES);
+  for (size_t i = 0; i < EXPECTED_NUM_ENTRIES; i++) {
+    repo.insert(makeKey(i));
+    if (i >= static_cast<size_t>(state.range(0)))
+      consumer.insert(makeKey(i));
+  }
+  IBLT diff = repo - consumer;
+
+  int64_t nComplete = 0;
+  for (auto _ : state) {
+    std::set<IBLT::Key> positive;
+    std::set<IBLT::Key> negative;
+    nComplete += diff.listEntries(positive, negative);
+  }
+
+  state.counters["complete"] = benchmark::Counter(nComplete, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_IbltListEntries)->DenseRange(500, 1500, 100);
+
+// what LogicRepo::appendIBLT does for every hello and sync reply
+static void
+BM_IbltAppendToName(benchmark::State& state)
+{
+  IBLT iblt(state.range(0));
+  for (int64_t i = 0; i < state.range(0); i++) {
+    iblt.insert(makeKey(i));
+  }
+
+  for (auto _ : state) {
+    ndn::Name name("/sync/prefix");
+    std::vector<uint8_t> table = iblt.encode();
+    name.appendNumber(table.size());
+    name.append(table.begin(), table.end());
+    benchmark::DoNotOptimize(name);
+  }
+
+  state.SetBytesProcessed(state.iterations() * IBLT::tableSize(state.range(0)) * IBLT::CELL_SIZE);
+}
+BENCHMARK(BM_IbltAppendToName)->RangeMultiplier(10)->Range(100, 100000);
+
+// what LogicRepo::bulkLoad does with 1M prefixes, arg: threads
+static void
+BM_IbltParallelBuild(benchmark::State& state)
+{
+  const size_t nKeys = 1000000;
+  const size_t nThreads = state.range(0);
+
+  for (auto _ : state) {
+    std::vector<IBLT> partials(nThreads, IBLT(EXPECTED_NUM_ENTRIES));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nThreads; t++) {
+      threads.emplace_back([&, t] {
+          for (size_t i = nKeys * t / nThreads; i < nKeys * (t + 1) / nThreads; i++) {
+            partials[t].insert(makeKey(i));
+          }
+        });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    IBLT iblt(EXPECTED_NUM_ENTRIES);
+    for (const auto& partial : partials) {
+      iblt += partial;
+    }
+    benchmark::DoNotOptimize(iblt.getDigest());
+  }
+}
+BENCHMARK(BM_IbltParallelBuild)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)
+                               ->UseRealTime();
+
+}
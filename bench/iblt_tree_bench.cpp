@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+
+#include <set>
+
+#include "iblt_tree.hpp"
+
+namespace psync {
+
+static const size_t FANOUT = 16;
+static const size_t DEPTH = 2;
+static const size_t LEAF_ENTRIES = 40;
+
+static IBLT::Key
+makeKey(size_t i)
+{
+  return IBLT::makeKey("/org/site/building/room/sensor-" + std::to_string(i) + "/1");
+}
+
+static void
+BM_IbltTreeInsert(benchmark::State& state)
+{
+  IBLTTree tree(FANOUT, DEPTH, LEAF_ENTRIES);
+  size_t i = 0;
+
+  for (auto _ : state) {
+    tree.insert(makeKey(i++));
+  }
+}
+BENCHMARK(BM_IbltTreeInsert);
+
+// Consumer descent over a group of 1M prefixes, arg: keys that differ.
+// Counts the nodes and leaves a consumer asks for in one catch-up.
+static void
+BM_IbltTreeDescend(benchmark::State& state)
+{
+  const size_t nKeys = 1000000;
+  IBLTTree repo(FANOUT, DEPTH, LEAF_ENTRIES);
+  IBLTTree consumer(FANOUT, DEPTH, LEAF_ENTRIES);
+  for (size_t i = 0; i < nKeys; i++) {
+    repo.insert(makeKey(i));
+    if (i >= static_cast<size_t>(state.range(0)))
+      consumer.insert(makeKey(i));
+  }
+
+  int64_t nRequests = 0;
+  int64_t nComplete = 0;
+  for (auto _ : state) {
+    nRequests = 0;
+    nComplete = 0;
+    std::vector<std::pair<size_t, size_t>> nodes(1, std::make_pair(0, 0));
+    while (!nodes.empty()) {
+      size_t level = nodes.back().first;
+      size_t index = nodes.back().second;
+      nodes.pop_back();
+      ++nRequests;
+
+      if (level == DEPTH) {
+        IBLT diff = repo.getLeafTable(index) - consumer.getLeafTable(index);
+        std::set<IBLT::Key> positive;
+        std::set<IBLT::Key> negative;
+        nComplete += diff.listEntries(positive, negative);
+        continue;
+      }
+
+      std::vector<uint8_t> digests = consumer.encodeChildDigests(level, index);
+      std::vector<size_t> children;
+      repo.getDifferingChildren(level, index, digests.data(), digests.size(), children);
+      for (auto child : children) {
+        nodes.push_back(std::make_pair(level + 1, child));
+      }
+    }
+  }
+  state.counters["requests"] = nRequests;
+  state.counters["leaves_peeled"] = nComplete;
+}
+BENCHMARK(BM_IbltTreeDescend)->Arg(1)->Arg(100)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+}
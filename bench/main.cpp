@@ -0,0 +1,8 @@
+// Micro-benchmarks for the sync core.
+//
+// Results are machine readable with e.g.
+//   ./build/bench/partialsync-bench --benchmark_format=json --benchmark_out=bench.json
+
+#include <benchmark/benchmark.h>
+
+BENCHMARK_MAIN();
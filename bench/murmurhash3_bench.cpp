@@ -0,0 +1,21 @@
+#include <benchmark/benchmark.h>
+
+#include "murmurhash3.hpp"
+
+namespace psync {
+
+static void
+BM_MurmurHash3(benchmark::State& state)
+{
+  std::vector<unsigned char> key(state.range(0), 'a');
+  uint32_t seed = 0;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MurmurHash3(seed++, key));
+  }
+
+  state.SetBytesProcessed(state.iterations() * key.size());
+}
+BENCHMARK(BM_MurmurHash3)->RangeMultiplier(2)->Range(4, 1024);
+
+}
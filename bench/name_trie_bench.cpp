@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+
+#include <map>
+
+#include "name_trie.hpp"
+
+namespace psync {
+
+static std::string
+makeName(size_t i)
+{
+  return "/org/site-" + std::to_string(i % 10) + "/building/room/sensor-" + std::to_string(i);
+}
+
+static void
+BM_NameTrieInsert(benchmark::State& state)
+{
+  NameTrie names;
+  size_t i = 0;
+
+  for (auto _ : state) {
+    names.insert(makeName(i++));
+  }
+  state.counters["bytes_per_name"] = names.memoryUsage() / static_cast<double>(names.size());
+}
+BENCHMARK(BM_NameTrieInsert);
+
+static void
+BM_NameTrieFind(benchmark::State& state)
+{
+  NameTrie names;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    names.insert(makeName(i));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(names.find(makeName(i++ % state.range(0))));
+  }
+}
+BENCHMARK(BM_NameTrieFind)->Arg(1000)->Arg(1000000);
+
+// what hello generation does with every name
+static void
+BM_NameTrieIterate(benchmark::State& state)
+{
+  NameTrie names;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    names.insert(makeName(i));
+  }
+
+  for (auto _ : state) {
+    std::size_t length = 0;
+    names.forEach([&] (NameTrie::Id id, const std::string& name) {
+        length += name.size();
+      });
+    benchmark::DoNotOptimize(length);
+  }
+}
+BENCHMARK(BM_NameTrieIterate)->Arg(1000)->Arg(1000000);
+
+// the std::map the trie replaced, for comparison
+static void
+BM_NameMapIterate(benchmark::State& state)
+{
+  std::map <std::string, uint32_t> names;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    names[makeName(i)] = 0;
+  }
+
+  for (auto _ : state) {
+    std::size_t length = 0;
+    for (auto& name : names) {
+      length += name.first.size();
+    }
+    benchmark::DoNotOptimize(length);
+  }
+}
+BENCHMARK(BM_NameMapIterate)->Arg(1000)->Arg(1000000);
+
+}
@@ -0,0 +1,23 @@
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "xxhash64.hpp"
+
+namespace psync {
+
+static void
+BM_XXH64(benchmark::State& state)
+{
+  std::vector<uint8_t> key(state.range(0), 'a');
+  uint64_t seed = 0;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(XXH64(key.data(), key.size(), seed++));
+  }
+
+  state.SetBytesProcessed(state.iterations() * key.size());
+}
+BENCHMARK(BM_XXH64)->RangeMultiplier(2)->Range(4, 1024);
+
+}
@@ -0,0 +1,114 @@
+#include "forwarder.hpp"
+
+namespace psync {
+namespace sim {
+
+SimForwarder::SimForwarder(ndn::Scheduler& scheduler, ndn::time::milliseconds delay,
+                           double lossRate, uint32_t seed)
+: m_scheduler(scheduler)
+, m_delay(delay)
+, m_loss(lossRate)
+, m_rng(seed)
+{
+}
+
+void
+SimForwarder::addFace(ndn::util::DummyClientFace& face)
+{
+  ndn::util::DummyClientFace* facePtr = &face;
+  face.onSendInterest.connect([this, facePtr] (const ndn::Interest& interest) {
+      forwardInterest(facePtr, interest);
+    });
+  face.onSendData.connect([this, facePtr] (const ndn::Data& data) {
+      returnData(facePtr, data);
+    });
+}
+
+void
+SimForwarder::addRoute(const ndn::Name& prefix, ndn::util::DummyClientFace& face)
+{
+  m_fib[prefix] = &face;
+}
+
+bool
+SimForwarder::isLost()
+{
+  if (m_loss(m_rng)) {
+    ++m_stats.nLost;
+    return true;
+  }
+  return false;
+}
+
+void
+SimForwarder::forwardInterest(ndn::util::DummyClientFace* from, const ndn::Interest& interest)
+{
+  ++m_stats.nInterests;
+  m_stats.interestBytes += interest.wireEncode().size();
+  if (m_interestObserver)
+    m_interestObserver(interest);
+
+  if (isLost())
+    return;
+
+  // longest prefix match
+  ndn::util::DummyClientFace* nexthop = nullptr;
+  const ndn::Name& name = interest.getName();
+  for (ssize_t len = name.size(); len >= 0 && nexthop == nullptr; len--) {
+    auto route = m_fib.find(name.getPrefix(len));
+    if (route != m_fib.end() && route->second != from)
+      nexthop = route->second;
+  }
+  if (nexthop == nullptr)
+    return;
+
+  auto pit = m_pit.find(name);
+  if (pit != m_pit.end()) {
+    bool isNew = pit->second.downstreams.insert(from).second;
+    if (isNew)
+      ++m_stats.nAggregated;
+    return;
+  }
+
+  PitEntry& entry = m_pit[name];
+  entry.downstreams.insert(from);
+  entry.expirationEvent = m_scheduler.scheduleEvent(interest.getInterestLifetime(),
+                                                    [this, name] { m_pit.erase(name); });
+
+  m_scheduler.scheduleEvent(m_delay, [nexthop, interest] { nexthop->receive(interest); });
+}
+
+void
+SimForwarder::returnData(ndn::util::DummyClientFace* from, const ndn::Data& data)
+{
+  ++m_stats.nData;
+  m_stats.dataBytes += data.wireEncode().size();
+  if (m_dataObserver)
+    m_dataObserver(data);
+
+  if (isLost())
+    return;
+
+  // sync and hello replies extend the interest name by the IBLT
+  const ndn::Name& name = data.getName();
+  satisfy(name, data);
+  if (name.size() >= 2)
+    satisfy(name.getPrefix(-2), data);
+}
+
+void
+SimForwarder::satisfy(const ndn::Name& pitName, const ndn::Data& data)
+{
+  auto pit = m_pit.find(pitName);
+  if (pit == m_pit.end())
+    return;
+
+  for (ndn::util::DummyClientFace* downstream : pit->second.downstreams) {
+    m_scheduler.scheduleEvent(m_delay, [downstream, data] { downstream->receive(data); });
+  }
+  m_scheduler.cancelEvent(pit->second.expirationEvent);
+  m_pit.erase(pit);
+}
+
+} // namespace sim
+} // namespace psync
@@ -0,0 +1,111 @@
+#ifndef SIM_FORWARDER_HPP
+#define SIM_FORWARDER_HPP
+
+#include <map>
+#include <random>
+#include <set>
+
+#include <ndn-cxx/face.hpp>
+#include <ndn-cxx/util/dummy-client-face.hpp>
+#include <ndn-cxx/util/scheduler.hpp>
+
+namespace psync {
+namespace sim {
+
+struct LinkStats
+{
+  LinkStats()
+  : nInterests(0)
+  , nData(0)
+  , interestBytes(0)
+  , dataBytes(0)
+  , nLost(0)
+  , nAggregated(0)
+  {}
+
+  uint64_t nInterests;
+  uint64_t nData;
+  uint64_t interestBytes;
+  uint64_t dataBytes;
+  uint64_t nLost;
+  uint64_t nAggregated; // interests absorbed by an existing PIT entry
+};
+
+/**
+ * A forwarder connecting DummyClientFaces in one process.
+ *
+ * Interests go to the face with the longest matching route, identical
+ * pending interests are aggregated as in NFD, and Data returns along the
+ * PIT. Every hop adds a fixed delay and drops packets with a given
+ * probability.
+ */
+class SimForwarder
+{
+public:
+  typedef std::function<void(const ndn::Interest&)> InterestObserver;
+  typedef std::function<void(const ndn::Data&)> DataObserver;
+
+  SimForwarder(ndn::Scheduler& scheduler, ndn::time::milliseconds delay,
+               double lossRate, uint32_t seed);
+
+  void
+  addFace(ndn::util::DummyClientFace& face);
+
+  void
+  addRoute(const ndn::Name& prefix, ndn::util::DummyClientFace& face);
+
+  void
+  onInterest(const InterestObserver& observer)
+  {
+    m_interestObserver = observer;
+  }
+
+  void
+  onData(const DataObserver& observer)
+  {
+    m_dataObserver = observer;
+  }
+
+  const LinkStats&
+  getStats() const
+  {
+    return m_stats;
+  }
+
+private:
+  struct PitEntry
+  {
+    std::set <ndn::util::DummyClientFace*> downstreams;
+    ndn::EventId expirationEvent;
+  };
+
+  void
+  forwardInterest(ndn::util::DummyClientFace* from, const ndn::Interest& interest);
+
+  void
+  returnData(ndn::util::DummyClientFace* from, const ndn::Data& data);
+
+  void
+  satisfy(const ndn::Name& pitName, const ndn::Data& data);
+
+  bool
+  isLost();
+
+private:
+  ndn::Scheduler& m_scheduler;
+  ndn::time::milliseconds m_delay;
+  std::bernoulli_distribution m_loss;
+  std::mt19937 m_rng;
+
+  std::map <ndn::Name, ndn::util::DummyClientFace*> m_fib;
+  std::map <ndn::Name, PitEntry> m_pit;
+
+  InterestObserver m_interestObserver;
+  DataObserver m_dataObserver;
+  LinkStats m_stats;
+};
+
+} // namespace sim
+} // namespace psync
+
+#endif
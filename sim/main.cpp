@@ -0,0 +1,540 @@
+// In-process PartialSync simulation: one LogicRepo, optionally followed by
+// replica repos or split into partitions, and many LogicConsumers on
+// DummyClientFaces joined by a SimForwarder. Consumers are spread evenly
+// over the replicas, and sync with every partition.
+//
+//   partialsync-sim --consumers=1000 --producers=10000 --subscriptions=10
+//     --publish-rate=1000 --duration=30 --delay=10 --loss=0.01
+//     --trace=sim.trace --trace-level=2 --workers=4 --reply-signing=digest
+//     --coalesce-us=2000 --coalesce-max-us=10000 --replicas=2
+//     --partitions=4 --join-at=5 --tree-depth=2 --tree-fanout=16
+//     --stream=64
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ndn-cxx/encoding/block-helpers.hpp>
+#include <ndn-cxx/util/dummy-client-face.hpp>
+#include <ndn-cxx/util/scheduler.hpp>
+
+#include "forwarder.hpp"
+#include "logic_consumer.hpp"
+#include "logic_repo.hpp"
+#include "trace.hpp"
+
+namespace psync {
+namespace sim {
+
+namespace time = ndn::time;
+
+struct Options
+{
+  Options()
+  : nConsumers(100)
+  , nProducers(1000)
+  , nSubscriptions(10)
+  , falsePositive(0.001)
+  , publishRate(100)
+  , duration(10)
+  , delayMs(10)
+  , lossRate(0)
+  , expectedNumEntries(100)
+  , nWorkers(0)
+  , coalesceUs(0)
+  , coalesceMaxUs(0)
+  , nReplicas(0)
+  , nPartitions(1)
+  , joinAt(0)
+  , treeDepth(0)
+  , treeFanout(16)
+  , streamCapacity(0)
+  , replySigning(SigningPolicy::SIGN_IDENTITY)
+  , seed(1)
+  , traceLevel(trace::LEVEL_INFO)
+  {}
+
+  size_t nConsumers;
+  size_t nProducers;
+  size_t nSubscriptions;
+  double falsePositive;
+  double publishRate; // publications per second, over all producers
+  double duration;    // seconds of publishing
+  int delayMs;        // one-way delay per hop
+  double lossRate;
+  size_t expectedNumEntries;
+  size_t nWorkers; // repo worker threads, 0 for none
+  int64_t coalesceUs;    // repo coalescing window, 0 answers every update
+  int64_t coalesceMaxUs; // latest pending pass after the first update
+  size_t nReplicas;      // repos replicating the publishing one
+  size_t nPartitions;    // repos the producer prefixes are hashed onto
+  double joinAt;         // seconds until one more partition joins, 0 for never
+  size_t treeDepth;      // levels of the IBLT tree, 0 for plain sync
+  size_t treeFanout;
+  size_t streamCapacity; // consumers pull from an update stream, 0 for callbacks
+  SigningPolicy::Method replySigning; // for hello, sync and NACK replies
+  uint32_t seed;
+  std::string traceFile; // binary trace, read with psync-trace-dump
+  int traceLevel;
+};
+
+static bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "bad argument " << arg << std::endl;
+      return false;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    const char* value = arg.c_str() + eq + 1;
+
+    if (key == "consumers") options.nConsumers = std::strtoul(value, nullptr, 10);
+    else if (key == "producers") options.nProducers = std::strtoul(value, nullptr, 10);
+    else if (key == "subscriptions") options.nSubscriptions = std::strtoul(value, nullptr, 10);
+    else if (key == "false-positive") options.falsePositive = std::strtod(value, nullptr);
+    else if (key == "publish-rate") options.publishRate = std::strtod(value, nullptr);
+    else if (key == "duration") options.duration = std::strtod(value, nullptr);
+    else if (key == "delay") options.delayMs = std::atoi(value);
+    else if (key == "loss") options.lossRate = std::strtod(value, nullptr);
+    else if (key == "expected-entries") options.expectedNumEntries = std::strtoul(value, nullptr, 10);
+    else if (key == "workers") options.nWorkers = std::strtoul(value, nullptr, 10);
+    else if (key == "coalesce-us") options.coalesceUs = std::strtoll(value, nullptr, 10);
+    else if (key == "coalesce-max-us") options.coalesceMaxUs = std::strtoll(value, nullptr, 10);
+    else if (key == "replicas") options.nReplicas = std::strtoul(value, nullptr, 10);
+    else if (key == "partitions") options.nPartitions = std::strtoul(value, nullptr, 10);
+    else if (key == "join-at") options.joinAt = std::strtod(value, nullptr);
+    else if (key == "tree-depth") options.treeDepth = std::strtoul(value, nullptr, 10);
+    else if (key == "tree-fanout") options.treeFanout = std::strtoul(value, nullptr, 10);
+    else if (key == "stream") options.streamCapacity = std::strtoul(value, nullptr, 10);
+    else if (key == "reply-signing") {
+      std::string method = value;
+      if (method == "identity") options.replySigning = SigningPolicy::SIGN_IDENTITY;
+      else if (method == "digest") options.replySigning = SigningPolicy::SIGN_DIGEST_SHA256;
+      else if (method == "hmac") options.replySigning = SigningPolicy::SIGN_HMAC_SHA256;
+      else {
+        std::cerr << "--reply-signing is identity, digest or hmac" << std::endl;
+        return false;
+      }
+    }
+    else if (key == "seed") options.seed = std::strtoul(value, nullptr, 10);
+    else if (key == "trace") options.traceFile = value;
+    else if (key == "trace-level") options.traceLevel = std::atoi(value);
+    else {
+      std::cerr << "unknown option --" << key << std::endl;
+      return false;
+    }
+  }
+
+  if (options.nPartitions == 0 || (options.nPartitions > 1 && options.nReplicas > 0)) {
+    std::cerr << "--partitions is at least 1, and replicas need a single partition" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const time::milliseconds HANDOFF_DELAY(2000);
+
+static std::string
+producerName(size_t i)
+{
+  return "/sim/producer-" + std::to_string(i);
+}
+
+static double
+percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+class Simulation
+{
+public:
+  explicit
+  Simulation(const Options& options)
+  : m_options(options)
+  , m_scheduler(m_ioService)
+  , m_forwarder(m_scheduler, time::milliseconds(options.delayMs), options.lossRate, options.seed)
+  , m_rng(options.seed)
+  , m_syncPrefix("/sim/sync")
+  , m_nHello(0)
+  , m_nNack(0)
+  , m_nMiss(0)
+  , m_nContinue(0)
+  , m_nSyncReplies(0)
+  , m_nPublished(0)
+  {
+  }
+
+  void
+  run()
+  {
+    m_repoFace.reset(new ndn::util::DummyClientFace(m_ioService, {false, false}));
+    m_forwarder.addFace(*m_repoFace);
+    m_forwarder.addRoute("/sim", *m_repoFace);
+    m_repo.reset(new LogicRepo(m_options.expectedNumEntries, *m_repoFace, m_syncPrefix,
+                               time::milliseconds(1000), time::milliseconds(1000)));
+    SigningPolicy& policy = m_policy;
+    policy.setHmacKey("/sim/hmac-key", std::vector<uint8_t>(32, 0x5a));
+    policy.setMethod(SigningPolicy::HELLO_REPLY, m_options.replySigning);
+    policy.setMethod(SigningPolicy::SYNC_REPLY, m_options.replySigning);
+    policy.setMethod(SigningPolicy::NACK_REPLY, m_options.replySigning);
+    m_repo->setSigningPolicy(policy);
+    m_repo->setWorkerThreads(m_options.nWorkers);
+    m_repo->setCoalescingWindow(time::microseconds(m_options.coalesceUs),
+                                time::microseconds(m_options.coalesceMaxUs));
+    if (m_options.treeDepth > 0) {
+      m_repo->enableTreeSync(m_options.treeFanout, m_options.treeDepth,
+                             m_options.expectedNumEntries);
+    }
+
+    // the repo is the first partition, each producer starts at its owner
+    if (m_options.nPartitions > 1) {
+      m_ring.addPartition(m_syncPrefix.toUri());
+      for (size_t i = 1; i < m_options.nPartitions; i++) {
+        addPartition();
+      }
+      m_repo->setPartitions(m_ring);
+      for (const auto& partition : m_partitions) {
+        partition->logic->setPartitions(m_ring);
+      }
+      m_publishRing = m_ring;
+    }
+    std::map <LogicRepo*, std::vector<std::pair<std::string, uint32_t> > > tables;
+    for (size_t i = 0; i < m_options.nProducers; i++) {
+      tables[&getOwner(producerName(i))].push_back(std::make_pair(producerName(i), 0));
+    }
+    for (const auto& table : tables) {
+      table.first->bulkLoad(table.second);
+    }
+
+    // replicas learn the producers from the repo
+    for (size_t i = 0; i < m_options.nReplicas; i++) {
+      std::unique_ptr<RepoNode> replica = makeRepoNode("/sim/replica-" + std::to_string(i));
+      replica->logic->addReplica(m_syncPrefix);
+      m_replicas.push_back(std::move(replica));
+    }
+
+    m_forwarder.onInterest(bind(&Simulation::onInterest, this, _1));
+    m_forwarder.onData(bind(&Simulation::onData, this, _1));
+
+    for (size_t i = 0; i < m_options.nConsumers; i++) {
+      addConsumer();
+    }
+
+    time::nanoseconds interval(static_cast<int64_t>(1e9 / m_options.publishRate));
+    m_scheduler.scheduleEvent(interval, bind(&Simulation::publish, this, interval));
+
+    if (m_options.nPartitions > 1 && m_options.joinAt > 0) {
+      m_scheduler.scheduleEvent(time::milliseconds(static_cast<int64_t>(m_options.joinAt * 1000)),
+                                bind(&Simulation::joinPartition, this));
+    }
+
+    // let the last publications propagate before stopping
+    time::milliseconds end(static_cast<int64_t>(m_options.duration * 1000) + 20 * m_options.delayMs + 1000);
+    m_scheduler.scheduleEvent(end, [this] { m_ioService.stop(); });
+
+    m_start = time::steady_clock::now();
+    m_ioService.run();
+
+    report();
+  }
+
+private:
+  struct RepoNode
+  {
+    ndn::Name syncPrefix;
+    std::unique_ptr<ndn::util::DummyClientFace> face;
+    std::unique_ptr<LogicRepo> logic;
+  };
+
+  struct Consumer
+  {
+    std::unique_ptr<ndn::util::DummyClientFace> face;
+    std::unique_ptr<LogicConsumer> logic;
+    RecieveHelloCallback onHello;
+    UpdateCallback onUpdate;
+    std::vector <std::string> subscriptions;
+  };
+
+  std::unique_ptr<RepoNode>
+  makeRepoNode(const std::string& name)
+  {
+    std::unique_ptr<RepoNode> node(new RepoNode);
+    node->syncPrefix = name;
+    node->face.reset(new ndn::util::DummyClientFace(m_ioService, {false, false}));
+    m_forwarder.addFace(*node->face);
+    m_forwarder.addRoute(node->syncPrefix, *node->face);
+    node->syncPrefix.append("sync");
+    node->logic.reset(new LogicRepo(m_options.expectedNumEntries, *node->face, node->syncPrefix,
+                                    time::milliseconds(1000), time::milliseconds(1000)));
+    node->logic->setSigningPolicy(m_policy);
+    node->logic->setCoalescingWindow(time::microseconds(m_options.coalesceUs),
+                                     time::microseconds(m_options.coalesceMaxUs));
+    if (m_options.treeDepth > 0) {
+      node->logic->enableTreeSync(m_options.treeFanout, m_options.treeDepth,
+                                  m_options.expectedNumEntries);
+    }
+    return node;
+  }
+
+  void
+  addPartition()
+  {
+    std::unique_ptr<RepoNode> partition =
+      makeRepoNode("/sim/partition-" + std::to_string(m_partitions.size() + 1));
+    m_ring.addPartition(partition->syncPrefix.toUri());
+    m_partitions.push_back(std::move(partition));
+  }
+
+  LogicRepo&
+  getOwner(const std::string& prefix)
+  {
+    const std::string& owner = m_publishRing.getPartition(prefix);
+    for (const auto& partition : m_partitions) {
+      if (partition->syncPrefix.toUri() == owner)
+        return *partition->logic;
+    }
+    return *m_repo;
+  }
+
+  // one more partition takes its share of the producers from the others,
+  // which publish there once the handoff is over
+  void
+  joinPartition()
+  {
+    addPartition();
+    m_repo->setPartitions(m_ring, HANDOFF_DELAY);
+    for (const auto& partition : m_partitions) {
+      partition->logic->setPartitions(m_ring, HANDOFF_DELAY);
+    }
+    for (const auto& consumer : m_consumers) {
+      consumer->logic->setPartitions(m_ring);
+    }
+    m_scheduler.scheduleEvent(HANDOFF_DELAY, [this] { m_publishRing = m_ring; });
+  }
+
+  void
+  addConsumer()
+  {
+    std::shared_ptr<Consumer> consumer = std::make_shared<Consumer>();
+    std::uniform_int_distribution<size_t> pick(0, m_options.nProducers - 1);
+    for (size_t i = 0; i < m_options.nSubscriptions; i++) {
+      consumer->subscriptions.push_back(producerName(pick(m_rng)));
+    }
+
+    Consumer* c = consumer.get();
+    consumer->onHello = [c] {
+      for (const std::string& prefix : c->subscriptions) {
+        c->logic->addSL(prefix);
+      }
+      c->logic->sendSyncInterest();
+    };
+    consumer->onUpdate = bind(&Simulation::onUpdate, this, _1);
+
+    consumer->face.reset(new ndn::util::DummyClientFace(m_ioService, {false, false}));
+    m_forwarder.addFace(*consumer->face);
+    // the repo takes the first consumer, then the replicas in turn
+    size_t repo = m_consumers.size() % (m_replicas.size() + 1);
+    ndn::Name syncPrefix = repo == 0 ? m_syncPrefix : m_replicas[repo - 1]->syncPrefix;
+    consumer->logic.reset(new LogicConsumer(syncPrefix, *consumer->face, consumer->onHello,
+                                            consumer->onUpdate, m_options.nSubscriptions,
+                                            m_options.falsePositive));
+    if (!m_ring.empty()) {
+      consumer->logic->setPartitions(m_ring);
+    }
+    if (m_options.treeDepth > 0) {
+      consumer->logic->setTreeSync(m_options.treeFanout, m_options.treeDepth,
+                                   m_options.expectedNumEntries);
+    }
+    if (m_options.streamCapacity > 0) {
+      readStream(consumer->logic->setUpdateStream(m_options.streamCapacity));
+    }
+    consumer->logic->sendHelloInterest();
+    m_consumers.push_back(consumer);
+  }
+
+  void
+  publish(time::nanoseconds interval)
+  {
+    if (time::steady_clock::now() - m_start >= time::milliseconds(static_cast<int64_t>(m_options.duration * 1000)))
+      return;
+
+    std::uniform_int_distribution<size_t> pick(0, m_options.nProducers - 1);
+    std::string prefix = producerName(pick(m_rng));
+    LogicRepo& repo = getOwner(prefix);
+    uint32_t seq = repo.getSeq(prefix) + 1;
+
+    m_publishTime[prefix + "/" + std::to_string(seq)] = time::steady_clock::now();
+    repo.publishData(ndn::makeStringBlock(ndn::tlv::Content, "sim"), time::milliseconds(1000), prefix);
+    ++m_nPublished;
+
+    m_scheduler.scheduleEvent(interval, bind(&Simulation::publish, this, interval));
+  }
+
+  void
+  onUpdate(const std::vector<MissingData>& updates)
+  {
+    for (const MissingData& update : updates) {
+      recordLatencies(update.prefix, update.seq1, update.seq2);
+    }
+  }
+
+  // drains the stream whenever a reply fills it, then waits again
+  void
+  readStream(UpdateStream& stream)
+  {
+    stream.await([this, &stream] {
+      UpdateRecord record;
+      while (stream.pop(record)) {
+        recordLatencies(stream.getPrefix(record.prefixId), record.seq1, record.seq2);
+      }
+      readStream(stream);
+    });
+  }
+
+  void
+  recordLatencies(const std::string& prefix, uint32_t seq1, uint32_t seq2)
+  {
+    time::steady_clock::TimePoint now = time::steady_clock::now();
+    for (uint32_t seq = seq1 + 1; seq <= seq2; seq++) {
+      auto it = m_publishTime.find(prefix + "/" + std::to_string(seq));
+      if (it != m_publishTime.end())
+        m_latencies.push_back(time::duration_cast<time::microseconds>(now - it->second).count() / 1000.);
+    }
+  }
+
+  // the component after the sync prefix of the repo name is under, if any
+  std::string
+  getSyncKind(const ndn::Name& name) const
+  {
+    if (name.size() > m_syncPrefix.size() && m_syncPrefix.isPrefixOf(name))
+      return name.get(m_syncPrefix.size()).toUri();
+    for (const auto& nodes : {&m_replicas, &m_partitions}) {
+      for (const auto& node : *nodes) {
+        if (name.size() > node->syncPrefix.size() && node->syncPrefix.isPrefixOf(name))
+          return name.get(node->syncPrefix.size()).toUri();
+      }
+    }
+    return "";
+  }
+
+  void
+  onInterest(const ndn::Interest& interest)
+  {
+    if (getSyncKind(interest.getName()) == "hello")
+      ++m_nHello;
+  }
+
+  void
+  onData(const ndn::Data& data)
+  {
+    std::string kind = getSyncKind(data.getName());
+    if (kind != "sync" && kind != "digest" && kind != "tree")
+      return;
+
+    ++m_nSyncReplies;
+    std::string content(reinterpret_cast<const char*>(data.getContent().value()),
+                        data.getContent().value_size());
+    if (content.compare(0, 4, "NACK") == 0)
+      ++m_nNack;
+    else if (content.compare(0, 4, "MISS") == 0)
+      ++m_nMiss;
+    else if (content.find("CONTINUE") != std::string::npos)
+      ++m_nContinue;
+  }
+
+  void
+  report()
+  {
+    std::sort(m_latencies.begin(), m_latencies.end());
+    const LinkStats& stats = m_forwarder.getStats();
+    double replies = std::max<uint64_t>(m_nSyncReplies, 1);
+
+    std::cout << "published " << m_nPublished << "\n"
+              << "deliveries " << m_latencies.size() << "\n"
+              << "latency_ms p50 " << percentile(m_latencies, 0.5)
+              << " p90 " << percentile(m_latencies, 0.9)
+              << " p99 " << percentile(m_latencies, 0.99)
+              << " max " << (m_latencies.empty() ? 0 : m_latencies.back()) << "\n"
+              << "sync_replies " << m_nSyncReplies
+              << " nack_rate " << m_nNack / replies
+              << " miss_rate " << m_nMiss / replies
+              << " continue_rate " << m_nContinue / replies << "\n"
+              << "hello " << m_nHello
+              << " fallback_hello " << (m_nHello > m_consumers.size() ? m_nHello - m_consumers.size() : 0) << "\n"
+              << "interests " << stats.nInterests
+              << " bytes_per_interest " << stats.interestBytes / std::max<double>(stats.nInterests, 1)
+              << " aggregated " << stats.nAggregated << "\n"
+              << "data " << stats.nData
+              << " bytes_per_data " << stats.dataBytes / std::max<double>(stats.nData, 1) << "\n"
+              << "lost " << stats.nLost << "\n"
+              << "repo metrics:\n" << m_repo->getMetrics().toString();
+    for (size_t i = 0; i < m_replicas.size(); i++) {
+      std::cout << "replica " << i << " metrics:\n" << m_replicas[i]->logic->getMetrics().toString();
+    }
+    for (size_t i = 0; i < m_partitions.size(); i++) {
+      std::cout << "partition " << i + 1 << " metrics:\n" << m_partitions[i]->logic->getMetrics().toString();
+    }
+    std::cout << std::flush;
+  }
+
+private:
+  Options m_options;
+  boost::asio::io_service m_ioService;
+  ndn::Scheduler m_scheduler;
+  SimForwarder m_forwarder;
+  std::mt19937 m_rng;
+  ndn::Name m_syncPrefix;
+
+  std::unique_ptr<ndn::util::DummyClientFace> m_repoFace;
+  std::unique_ptr<LogicRepo> m_repo;
+  SigningPolicy m_policy;
+  std::vector <std::unique_ptr<RepoNode> > m_replicas;
+  // partitions after the repo, which is the first
+  std::vector <std::unique_ptr<RepoNode> > m_partitions;
+  PartitionRing m_ring; // empty unless partitioned
+  PartitionRing m_publishRing; // m_ring as of the last finished handoff
+  std::vector <std::shared_ptr<Consumer> > m_consumers;
+
+  time::steady_clock::TimePoint m_start;
+  std::map <std::string, time::steady_clock::TimePoint> m_publishTime;
+  std::vector <double> m_latencies;
+
+  uint64_t m_nHello;
+  uint64_t m_nNack;
+  uint64_t m_nMiss;
+  uint64_t m_nContinue;
+  uint64_t m_nSyncReplies;
+  uint64_t m_nPublished;
+};
+
+} // namespace sim
+} // namespace psync
+
+int
+main(int argc, char** argv)
+{
+  psync::sim::Options options;
+  if (!psync::sim::parseOptions(argc, argv, options))
+    return 1;
+
+  if (!options.traceFile.empty() &&
+      !psync::trace::start(options.traceFile, options.traceLevel)) {
+    std::cerr << "cannot write trace to " << options.traceFile << std::endl;
+    return 1;
+  }
+
+  psync::sim::Simulation(options).run();
+  psync::trace::stop();
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cassert>
+
+#include "arena.hpp"
+
+namespace psync {
+
+Arena::Arena(std::size_t initialSize)
+: m_current(0)
+, m_offset(0)
+{
+  addBlock(initialSize);
+}
+
+Arena::~Arena()
+{
+  for (auto& block : m_blocks) {
+    ::operator delete(block.data);
+  }
+}
+
+void*
+Arena::allocate(std::size_t size, std::size_t alignment)
+{
+  std::size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+  if (offset + size > m_blocks[m_current].size) {
+    // later blocks may be left over from before the last rewind
+    while (++m_current < m_blocks.size() && m_blocks[m_current].size < size) {
+    }
+    if (m_current == m_blocks.size()) {
+      addBlock(size);
+    }
+    offset = 0;
+  }
+
+  m_offset = offset + size;
+  return m_blocks[m_current].data + offset;
+}
+
+void
+Arena::rewind(const Mark& mark)
+{
+  assert(mark.block < m_current || (mark.block == m_current && mark.offset <= m_offset));
+
+  m_current = mark.block;
+  m_offset = mark.offset;
+  if (m_current == 0 && m_offset == 0 && m_blocks.size() > 1) {
+    coalesce();
+  }
+}
+
+std::size_t
+Arena::used() const
+{
+  std::size_t used = m_offset;
+  for (std::size_t i = 0; i < m_current; i++) {
+    used += m_blocks[i].size;
+  }
+  return used;
+}
+
+std::size_t
+Arena::capacity() const
+{
+  std::size_t capacity = 0;
+  for (auto& block : m_blocks) {
+    capacity += block.size;
+  }
+  return capacity;
+}
+
+void
+Arena::addBlock(std::size_t minSize)
+{
+  // grow geometrically so spills are rare even before coalescing
+  std::size_t size = std::max(minSize, m_blocks.empty() ? 0 : m_blocks.back().size * 2);
+  Block block = {static_cast<uint8_t*>(::operator new(size)), size};
+  m_blocks.push_back(block);
+}
+
+void
+Arena::coalesce()
+{
+  std::size_t total = capacity();
+  for (auto& block : m_blocks) {
+    ::operator delete(block.data);
+  }
+  m_blocks.clear();
+  addBlock(total);
+}
+
+}
@@ -0,0 +1,183 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace psync {
+
+/**
+ * Monotonic arena for temporaries that live for one interest or publish.
+ *
+ * Allocation bumps a pointer and deallocation does nothing; memory comes
+ * back by rewinding to a mark. When the arena is rewound to empty after
+ * spilling into more than one block, the blocks are merged into one of
+ * their total size, so a steady workload stops touching the global heap.
+ *
+ * Not thread safe: an arena belongs to one thread (the face's io thread).
+ */
+class Arena
+{
+public:
+  struct Mark
+  {
+    std::size_t block;
+    std::size_t offset;
+  };
+
+  explicit Arena(std::size_t initialSize = 64 * 1024);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void*
+  allocate(std::size_t size, std::size_t alignment);
+
+  Mark
+  mark() const
+  {
+    Mark m = {m_current, m_offset};
+    return m;
+  }
+
+  // release everything allocated after the mark
+  void
+  rewind(const Mark& mark);
+
+  // bytes handed out since the arena was last empty
+  std::size_t
+  used() const;
+
+  // total size of the blocks held
+  std::size_t
+  capacity() const;
+
+private:
+  struct Block
+  {
+    uint8_t* data;
+    std::size_t size;
+  };
+
+  void
+  addBlock(std::size_t minSize);
+
+  void
+  coalesce();
+
+private:
+  std::vector <Block> m_blocks;
+  std::size_t m_current; // block being allocated from
+  std::size_t m_offset;  // next free byte in it
+};
+
+/**
+ * Rewinds an arena to where it was when the scope was entered. Scopes
+ * nest, so a helper can open its own without disturbing its caller.
+ */
+class ArenaScope
+{
+public:
+  explicit ArenaScope(Arena& arena)
+  : m_arena(arena)
+  , m_mark(arena.mark())
+  {}
+
+  ~ArenaScope()
+  {
+    m_arena.rewind(m_mark);
+  }
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+  Arena& m_arena;
+  Arena::Mark m_mark;
+};
+
+/**
+ * Allocator drawing from an arena, or from the global heap when it has
+ * none. Copying a container does not carry the arena over: copies are
+ * heap allocated unless an arena is passed explicitly, so a temporary can
+ * be stored in a long-lived structure without dangling after the rewind.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+  typedef T value_type;
+
+  ArenaAllocator()
+  : m_arena(nullptr)
+  {}
+
+  ArenaAllocator(Arena* arena)
+  : m_arena(arena)
+  {}
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)
+  : m_arena(other.arena())
+  {}
+
+  T*
+  allocate(std::size_t n)
+  {
+    if (m_arena == nullptr)
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void
+  deallocate(T* p, std::size_t)
+  {
+    if (m_arena == nullptr)
+      ::operator delete(p);
+  }
+
+  ArenaAllocator
+  select_on_container_copy_construction() const
+  {
+    return ArenaAllocator();
+  }
+
+  Arena*
+  arena() const
+  {
+    return m_arena;
+  }
+
+  template<typename U>
+  struct rebind
+  {
+    typedef ArenaAllocator<U> other;
+  };
+
+private:
+  Arena* m_arena;
+};
+
+template<typename T, typename U>
+inline bool
+operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+inline bool
+operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena() != b.arena();
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include "batch_signer.hpp"
+
+namespace psync {
+
+BatchSigner::BatchSigner(ThreadPool& pool, boost::asio::io_service& ioService,
+                         const SigningPolicy& policy, SigningPolicy::PacketClass packetClass,
+                         std::size_t maxBatchSize)
+: m_pool(pool)
+, m_ioService(ioService)
+, m_policy(policy)
+, m_packetClass(packetClass)
+, m_maxBatchSize(maxBatchSize)
+, m_isFlushScheduled(false)
+, m_alive(std::make_shared<bool>(true))
+{
+}
+
+BatchSigner::~BatchSigner()
+{
+  m_alive.reset();
+}
+
+void
+BatchSigner::add(const ndn::shared_ptr<ndn::Data>& data, const SignedCallback& onSigned)
+{
+  Item item = {data, onSigned};
+  m_batch.push_back(item);
+
+  if (m_batch.size() >= m_maxBatchSize) {
+    flush();
+  }
+  else if (!m_isFlushScheduled) {
+    // sign whatever else is added before the io_service gets back to us
+    m_isFlushScheduled = true;
+    std::weak_ptr<bool> alive = m_alive;
+    m_ioService.post([this, alive] {
+        if (alive.expired())
+          return;
+        m_isFlushScheduled = false;
+        flush();
+      });
+  }
+}
+
+void
+BatchSigner::flush()
+{
+  if (m_batch.empty())
+    return;
+
+  std::size_t sliceSize = (m_batch.size() + m_pool.size() - 1) / m_pool.size();
+  std::weak_ptr<bool> alive = m_alive;
+  for (std::size_t start = 0; start < m_batch.size(); start += sliceSize) {
+    auto slice = std::make_shared<Slice>();
+    slice->items.assign(m_batch.begin() + start,
+                        m_batch.begin() + std::min(start + sliceSize, m_batch.size()));
+    m_inFlight.push_back(std::make_pair(slice, slice->isSigned.get_future()));
+
+    const SigningPolicy& policy = m_policy;
+    SigningPolicy::PacketClass packetClass = m_packetClass;
+    boost::asio::io_service& ioService = m_ioService;
+    m_pool.submit([this, slice, alive, &policy, packetClass, &ioService] {
+        for (auto& item : slice->items) {
+          policy.sign(*item.data, packetClass, SigningPolicy::threadKeyChain());
+        }
+        slice->isSigned.set_value();
+        ioService.post([this, slice, alive] {
+            if (!alive.expired())
+              deliver(slice);
+          });
+      });
+  }
+  m_batch.clear();
+}
+
+void
+BatchSigner::drain()
+{
+  flush();
+  while (!m_inFlight.empty()) {
+    m_inFlight.front().second.wait();
+    deliver(m_inFlight.front().first);
+  }
+}
+
+void
+BatchSigner::deliver(const std::shared_ptr<Slice>& slice)
+{
+  // drain() may have delivered it before the posted handler ran
+  auto it = std::find_if(m_inFlight.begin(), m_inFlight.end(),
+                         [&slice] (const std::pair<std::shared_ptr<Slice>, std::future<void> >& p) {
+                           return p.first == slice;
+                         });
+  if (it == m_inFlight.end())
+    return;
+  m_inFlight.erase(it);
+
+  for (auto& item : slice->items) {
+    item.onSigned(item.data);
+  }
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef BATCH_SIGNER_HPP
+#define BATCH_SIGNER_HPP
+
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <ndn-cxx/data.hpp>
+
+#include "signing_policy.hpp"
+#include "thread_pool.hpp"
+
+namespace psync {
+
+/**
+ * Signs Data in batches spread over a thread pool.
+ *
+ * Packets added during one io_service turn, or up to maxBatchSize of
+ * them, form a batch. Each worker signs a slice of it with its own
+ * KeyChain, and the callbacks run back on the io thread.
+ */
+class BatchSigner
+{
+public:
+  typedef std::function<void(const ndn::shared_ptr<ndn::Data>&)> SignedCallback;
+
+  BatchSigner(ThreadPool& pool, boost::asio::io_service& ioService,
+              const SigningPolicy& policy, SigningPolicy::PacketClass packetClass,
+              std::size_t maxBatchSize = 64);
+
+  // callbacks of packets still being signed are not called, drain() first
+  ~BatchSigner();
+
+  void
+  add(const ndn::shared_ptr<ndn::Data>& data, const SignedCallback& onSigned);
+
+  void
+  flush();
+
+  /**
+   * Sign everything added so far and run its callbacks before returning,
+   * e.g. before the signer or its pool is replaced. Blocks the io thread
+   * until the workers are done with the batches in flight.
+   */
+  void
+  drain();
+
+private:
+  struct Item
+  {
+    ndn::shared_ptr<ndn::Data> data;
+    SignedCallback onSigned;
+  };
+
+  // a slice of a batch handed to one worker
+  struct Slice
+  {
+    std::vector<Item> items;
+    std::promise<void> isSigned;
+  };
+
+  // run the callbacks of a signed slice, once
+  void
+  deliver(const std::shared_ptr<Slice>& slice);
+
+private:
+  ThreadPool& m_pool;
+  boost::asio::io_service& m_ioService;
+  const SigningPolicy& m_policy;
+  SigningPolicy::PacketClass m_packetClass;
+  std::size_t m_maxBatchSize;
+
+  std::vector <Item> m_batch;
+  std::list <std::pair<std::shared_ptr<Slice>, std::future<void> > > m_inFlight;
+  bool m_isFlushScheduled;
+  std::shared_ptr<bool> m_alive;
+};
+
+}
+
+#endif
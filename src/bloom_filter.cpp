@@ -3,13 +3,14 @@
 #include <cstddef>
 #include <iterator>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <cstdlib>
 #include <cassert>
 #include <iostream>
 
 #include "bloom_filter.hpp"
-#include "parse.hpp"
-#include "murmurhash3.hpp"
 
 namespace psync {
 
@@ -30,8 +31,19 @@ bloom_parameters::compute_optimal_parameters()
   double min_k = 0.0;
   double curr_m = 0.0;
   double k = 1.0;
+  double max_k = 1000.0;
 
-  while (k < 1000.0)
+  // m(k) = -k*n / ln(1 - p^(1/k)) has a single minimum next to
+  // k = log2(1/p), so only its neighbours need evaluating. Same
+  // expressions and order as the full scan, hence the same result.
+  if (false_positive_probability > 0.0 && false_positive_probability < 1.0)
+  {
+    double closed_k = std::floor(-std::log2(false_positive_probability));
+    k = std::max(1.0, closed_k - 2.0);
+    max_k = std::min(max_k, closed_k + 4.0);
+  }
+
+  while (k < max_k)
   {
     double numerator   = (- k * projected_element_count);
     double denominator = std::log(1.0 - std::pow(false_positive_probability, 1.0 / k));
@@ -63,39 +75,128 @@ bloom_parameters::compute_optimal_parameters()
   return true;
 }
 
+/*************************************************************************/
+/* bloom-key */
+
+bloom_key::bloom_key(const std::string& key, const ArenaAllocator<salted_hash>& alloc)
+: key_(reinterpret_cast<const uint8_t*>(key.data()))
+, key_size_(key.size())
+, hashes_(alloc)
+{}
+
+bloom_key::bloom_key(const char* key, std::size_t size, const ArenaAllocator<salted_hash>& alloc)
+: key_(reinterpret_cast<const uint8_t*>(key))
+, key_size_(size)
+, hashes_(alloc)
+{}
+
+uint32_t
+bloom_key::hash(uint8_t hash_id, uint32_t salt)
+{
+  uint64_t id = static_cast<uint64_t>(hash_id) << 32 | salt;
+  for (std::size_t i = 0; i < hashes_.size(); ++i) {
+    if (hashes_[i].first == id)
+      return hashes_[i].second;
+  }
+
+  uint32_t h = psync::hash32(hash_id, salt, key_, key_size_);
+  hashes_.push_back(std::make_pair(id, h));
+  return h;
+}
+
+/*************************************************************************/
+/* bloom-shape */
+
+// shapes kept by bloom_shape::get(), past that they are built per call
+static const std::size_t max_cached_shapes = 1024;
+
+static void
+generate_unique_salt(unsigned int salt_count, unsigned long long int random_seed,
+                     bloom_shape::salt_type& salt);
+
+bloom_shape::bloom_shape(const bloom_parameters& p)
+: table_size(p.optimal_parameters.table_size)
+, raw_table_size(table_size / bits_per_char)
+, projected_element_count(p.projected_element_count)
+, desired_false_positive_probability(p.false_positive_probability)
+, random_seed((p.random_seed * 0xA5A5A5A5) + 1)
+, hash_id(DefaultHash::ID)
+{
+  generate_unique_salt(p.optimal_parameters.number_of_hashes, random_seed, salts);
+}
+
+std::shared_ptr<const bloom_shape>
+bloom_shape::get(unsigned int projected_element_count, unsigned int fp_milli, uint8_t hash_id)
+{
+  typedef std::tuple<unsigned int, unsigned int, uint8_t> key_type;
+  static std::mutex mutex;
+  static std::map <key_type, std::shared_ptr<const bloom_shape> > shapes;
+
+  key_type key(projected_element_count, fp_milli, hash_id);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = shapes.find(key);
+    if (it != shapes.end())
+      return it->second;
+  }
+
+  bloom_parameters opt;
+  opt.projected_element_count = projected_element_count;
+  opt.false_positive_probability = fp_milli/1000.;
+  opt.compute_optimal_parameters();
+  std::shared_ptr<bloom_shape> shape = std::make_shared<bloom_shape>(opt);
+  shape->hash_id = hash_id;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (shapes.size() < max_cached_shapes)
+    shapes.insert(std::make_pair(key, shape));
+  return shape;
+}
+
 /*************************************************************************/
 /* bloom-filter */
 
+// shape of a default-constructed filter, no salts and no bits
+static const std::shared_ptr<const bloom_shape>&
+empty_shape()
+{
+  static const std::shared_ptr<const bloom_shape> shape = [] {
+    bloom_parameters opt;
+    opt.optimal_parameters.number_of_hashes = 0;
+    opt.optimal_parameters.table_size = 0;
+    opt.projected_element_count = 0;
+    opt.false_positive_probability = 0.0;
+    opt.random_seed = 0;
+    return std::make_shared<bloom_shape>(opt);
+  }();
+  return shape;
+}
+
 bloom_filter::bloom_filter()
-: bit_table_(0)
-, salt_count_(0)
-, table_size_(0)
-, raw_table_size_(0)
-//, projected_element_count_(0)
+: shape_(empty_shape())
+, bit_table_(0)
 , inserted_element_count_(0)
-, random_seed_(0)
-//, desired_false_positive_probability_(0.0)
 {}
 
-bloom_filter::bloom_filter(const bloom_parameters& p)
-: bit_table_(0)
-, projected_element_count_(p.projected_element_count)
+bloom_filter::bloom_filter(const bloom_parameters& p, const allocator_type& alloc)
+: shape_(std::make_shared<bloom_shape>(p))
+, bit_table_(shape_->raw_table_size, 0x00, alloc)
+, inserted_element_count_(0)
+{
+}
+
+bloom_filter::bloom_filter(const std::shared_ptr<const bloom_shape>& shape,
+                           const allocator_type& alloc)
+: shape_(shape)
+, bit_table_(shape_->raw_table_size, 0x00, alloc)
 , inserted_element_count_(0)
-, random_seed_((p.random_seed * 0xA5A5A5A5) + 1)
-, desired_false_positive_probability_(p.false_positive_probability)
 {
-  salt_count_ = p.optimal_parameters.number_of_hashes;
-  table_size_ = p.optimal_parameters.table_size;
-  generate_unique_salt();
-  raw_table_size_ = table_size_ / bits_per_char;
-  //bit_table_ = new cell_type[static_cast<std::size_t>(raw_table_size_)];
-  bit_table_.resize(static_cast<std::size_t>(raw_table_size_), 0x00);
 }
 
 void
 bloom_filter::clear()
 {
-  bit_table_.resize(static_cast<std::size_t>(raw_table_size_), 0x00);
+  bit_table_.assign(static_cast<std::size_t>(shape_->raw_table_size), 0x00);
   inserted_element_count_ = 0;
 }
 
@@ -104,9 +205,11 @@ bloom_filter::insert(const std::string& key)
 {
   std::size_t bit_index = 0;
   std::size_t bit = 0;
-  for (std::size_t i = 0; i < salt_.size(); ++i)
+  const salt_type& salt = shape_->salts;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(key.data());
+  for (std::size_t i = 0; i < salt.size(); ++i)
   {
-     compute_indices(MurmurHash3(salt_[i], ParseHex(key)), bit_index, bit);
+     compute_indices(psync::hash32(shape_->hash_id, salt[i], bytes, key.size()), bit_index, bit);
      bit_table_[bit_index/bits_per_char] |= bit_mask[bit];
   }
   ++inserted_element_count_;
@@ -115,17 +218,22 @@ bloom_filter::insert(const std::string& key)
 bool
 bloom_filter::contains(const std::string& key)
 {
-  if (projected_element_count_== 1 && desired_false_positive_probability_ == 0.001) {
-    // subscribe all
+  bloom_key k(key);
+  return contains(k);
+}
+
+bool
+bloom_filter::contains(bloom_key& key) const
+{
+  if (subscribes_all()) {
     return true;
   }
 
-  std::size_t bit_index = 0;
-  std::size_t bit = 0;
-
-  for (std::size_t i = 0; i < salt_.size(); ++i)
+  const salt_type& salt = shape_->salts;
+  for (std::size_t i = 0; i < salt.size(); ++i)
   {
-    compute_indices(MurmurHash3(salt_[i], ParseHex(key)), bit_index, bit);
+    std::size_t bit_index = key.hash(shape_->hash_id, salt[i]) % shape_->table_size;
+    std::size_t bit = bit_index % bits_per_char;
     if ((bit_table_[bit_index/bits_per_char] & bit_mask[bit]) != bit_mask[bit]) {
       return false;
     }
@@ -134,28 +242,58 @@ bloom_filter::contains(const std::string& key)
   return true;
 }
 
+bool
+bloom_filter::subscribes_all() const
+{
+  // count 1 with fp 0.001 is how a consumer asks for every prefix
+  return shape_->projected_element_count == 1 && shape_->desired_false_positive_probability == 0.001;
+}
+
+bool
+bloom_filter::operator==(const bloom_filter& other) const
+{
+  if (shape_ != other.shape_ &&
+      (shape_->table_size != other.shape_->table_size ||
+       shape_->salts != other.shape_->salts ||
+       shape_->hash_id != other.shape_->hash_id ||
+       shape_->projected_element_count != other.shape_->projected_element_count ||
+       shape_->desired_false_positive_probability != other.shape_->desired_false_positive_probability)) {
+    return false;
+  }
+  return bit_table_.size() == other.bit_table_.size() &&
+         std::equal(bit_table_.begin(), bit_table_.end(), other.bit_table_.begin());
+}
+
 std::vector <bloom_filter::cell_type>
 bloom_filter::table()
 {
-  return bit_table_;
+  return std::vector <cell_type>(bit_table_.begin(), bit_table_.end());
 }
 
 void
 bloom_filter::setTable(std::vector <bloom_filter::cell_type> table)
 {
-  assert(table.size() == raw_table_size_);
-  bit_table_ = table;
+  setTable(table.data(), table.size());
+}
+
+void
+bloom_filter::setTable(const cell_type* table, std::size_t size)
+{
+  assert(size == shape_->raw_table_size);
+  bit_table_.assign(table, table + size);
 }
 
 unsigned int
 bloom_filter::getTableSize()
 {
-  return raw_table_size_;
+  return shape_->raw_table_size;
 }
 
-void
-bloom_filter::generate_unique_salt()
+static void
+generate_unique_salt(unsigned int salt_count, unsigned long long int random_seed,
+                     bloom_shape::salt_type& salt)
 {
+  typedef bloom_shape::bloom_type bloom_type;
   const unsigned int predef_salt_count = 128;
   static const bloom_type predef_salt[predef_salt_count] =
                              {
@@ -193,27 +331,27 @@ bloom_filter::generate_unique_salt()
                                 0xC569F575, 0xCDB2A091, 0x2CC016B4, 0x5C5F4421
                              };
 
-  if (salt_count_ <= predef_salt_count)
+  if (salt_count <= predef_salt_count)
   {
     std::copy(predef_salt,
-              predef_salt + salt_count_,
-              std::back_inserter(salt_));
-    for (unsigned int i = 0; i < salt_.size(); ++i)
+              predef_salt + salt_count,
+              std::back_inserter(salt));
+    for (unsigned int i = 0; i < salt.size(); ++i)
     {
-      salt_[i] = salt_[i] * salt_[(i + 3) % salt_.size()] + static_cast<bloom_type>(random_seed_);
+      salt[i] = salt[i] * salt[(i + 3) % salt.size()] + static_cast<bloom_type>(random_seed);
     }
   }
   else
   {
-    std::copy(predef_salt,predef_salt + predef_salt_count,std::back_inserter(salt_));
-    srand(static_cast<unsigned int>(random_seed_));
-    while (salt_.size() < salt_count_)
+    std::copy(predef_salt,predef_salt + predef_salt_count,std::back_inserter(salt));
+    srand(static_cast<unsigned int>(random_seed));
+    while (salt.size() < salt_count)
     {
       bloom_type current_salt = static_cast<bloom_type>(rand()) * static_cast<bloom_type>(rand());
       if (0 == current_salt) continue;
-      if (salt_.end() == std::find(salt_.begin(), salt_.end(), current_salt))
+      if (salt.end() == std::find(salt.begin(), salt.end(), current_salt))
       {
-        salt_.push_back(current_salt);
+        salt.push_back(current_salt);
       }
     }
   }
@@ -222,7 +360,7 @@ bloom_filter::generate_unique_salt()
 void
 bloom_filter::compute_indices(const bloom_type& hash, std::size_t& bit_index, std::size_t& bit)
 {
-  bit_index = hash % table_size_;
+  bit_index = hash % shape_->table_size;
   bit = bit_index % bits_per_char;
 }
 
@@ -1,8 +1,14 @@
 #ifndef BLOOM_FILTER_HPP
 #define BLOOM_FILTER_HPP
 
+#include <memory>
 #include <string>
 #include <vector>
+#include <utility>
+#include <inttypes.h>
+
+#include "arena.hpp"
+#include "hash_policy.hpp"
 
 namespace psync {
 
@@ -50,42 +56,112 @@ public:
   optimal_parameters_t   optimal_parameters;
 };
 
+/**
+ * Hash count, table size, salts and hash function of a bloom filter,
+ * everything but its bits. Immutable, so all filters of one shape share
+ * a single instance.
+ */
+struct bloom_shape
+{
+  typedef uint32_t bloom_type;
+  typedef std::vector <bloom_type> salt_type;
+
+  explicit bloom_shape(const bloom_parameters& p);
+
+  /**
+   * Shape of the filters consumers build from a projected element count
+   * and a false positive probability of fp_milli / 1000, hashed with
+   * hash_id, as carried in sync interests. Computed once per triple and
+   * shared between threads.
+   */
+  static std::shared_ptr<const bloom_shape>
+  get(unsigned int projected_element_count, unsigned int fp_milli,
+      uint8_t hash_id = DefaultHash::ID);
+
+  salt_type              salts;
+  unsigned int           table_size; // 8 * raw_table_size
+  unsigned int           raw_table_size;
+  unsigned int           projected_element_count;
+  double                 desired_false_positive_probability;
+  unsigned long long int random_seed;
+  uint8_t                hash_id; // a HashId
+};
+
+/**
+ * A key together with its hashes under the salts it has been checked
+ * against, so one key can be tested against many filters while hashing
+ * it at most once per distinct salt. The key string is not copied and
+ * must outlive the bloom_key.
+ */
+class bloom_key
+{
+public:
+  typedef std::pair<uint64_t, uint32_t> salted_hash; // hash id and salt, hash
+
+  explicit bloom_key(const std::string& key, const ArenaAllocator<salted_hash>& alloc = ArenaAllocator<salted_hash>());
+  bloom_key(const char* key, std::size_t size, const ArenaAllocator<salted_hash>& alloc = ArenaAllocator<salted_hash>());
+
+  uint32_t hash(uint8_t hash_id, uint32_t salt);
+
+private:
+  const uint8_t* key_;
+  std::size_t key_size_;
+  std::vector <salted_hash, ArenaAllocator<salted_hash> > hashes_;
+};
+
+/**
+ * Bloom filter whose bit table can be placed in an Arena, as done for the
+ * filters decoded from sync interests. Plain copies always go to the heap.
+ * The shape is shared, not copied.
+ */
 class bloom_filter
 {
 protected:
   typedef uint32_t bloom_type;
   typedef uint8_t cell_type;
-  typedef std::vector <cell_type>::iterator Iterator;
 
 public:
+  typedef ArenaAllocator<cell_type> allocator_type;
+  typedef std::vector <cell_type, allocator_type> table_type;
+  typedef bloom_shape::salt_type salt_type;
+  typedef table_type::iterator Iterator;
+
   bloom_filter();
-  bloom_filter(const bloom_parameters& p);
+  bloom_filter(const bloom_parameters& p, const allocator_type& alloc = allocator_type());
+  explicit bloom_filter(const std::shared_ptr<const bloom_shape>& shape,
+                        const allocator_type& alloc = allocator_type());
+  bloom_filter(const bloom_filter& other) = default;
+  bloom_filter(bloom_filter&& other) = default;
+  bloom_filter& operator=(const bloom_filter& other) = default;
+  bloom_filter& operator=(bloom_filter&& other) = default;
   virtual ~bloom_filter()
   {}
 
   void clear();
   void insert(const std::string& key);
   bool contains(const std::string& key);
+  bool contains(bloom_key& key) const;
+  bool subscribes_all() const;
+  // same shape and bits
+  bool operator==(const bloom_filter& other) const;
+  const salt_type& salts() const { return shape_->salts; }
+  const std::shared_ptr<const bloom_shape>& shape() const { return shape_; }
+  const table_type& bit_table() const { return bit_table_; }
   std::vector <cell_type> table();
   void setTable(std::vector <cell_type> table);
+  void setTable(const cell_type* table, std::size_t size);
   unsigned int getTableSize();
+  unsigned int getBitSize() const { return shape_->table_size; }
   Iterator begin() { return bit_table_.begin(); }
   Iterator end()   { return bit_table_.end();   }
 
 private:
-  void generate_unique_salt();
   void compute_indices(const bloom_type& hash, std::size_t& bit_index, std::size_t& bit);
 
 private:
-  std::vector <bloom_type> salt_;
-  std::vector <cell_type>             bit_table_;
-  unsigned int            salt_count_;
-  unsigned int            table_size_; // 8 * raw_table_size;
-  unsigned int            raw_table_size_;
-  unsigned int            projected_element_count_;
+  std::shared_ptr<const bloom_shape> shape_;
+  table_type              bit_table_;
   unsigned int            inserted_element_count_;
-  unsigned long long int  random_seed_;
-  double                  desired_false_positive_probability_;
 };
 
 }
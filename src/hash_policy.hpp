@@ -0,0 +1,96 @@
+#ifndef HASH_POLICY_HPP
+#define HASH_POLICY_HPP
+
+#include <inttypes.h>
+#include <cstddef>
+
+#include "murmurhash3.hpp"
+#include "xxhash64.hpp"
+
+// Hash of the IBLT typedef, set by ./waf configure: 0 MurmurHash3, 1 XXH64
+#ifndef PSYNC_HASH
+#define PSYNC_HASH 0
+#endif
+
+namespace psync {
+
+/**
+ * Hash functions by the id carried on the wire, in IBLT encodings and
+ * next to the bloom filter of sync interests. Ids are never reused.
+ */
+enum HashId : uint8_t {
+  HASH_MURMUR3 = 0,
+  HASH_XXH64   = 1
+};
+
+/**
+ * MurmurHash3 x86_32. 64-bit output combines the seeds seed and seed + 1,
+ * which keeps the keys of existing deployments.
+ */
+struct Murmur3Hash
+{
+  static const uint8_t ID = HASH_MURMUR3;
+
+  static uint32_t
+  hash32(uint32_t seed, const uint8_t* data, size_t len)
+  {
+    return MurmurHash3(seed, data, len);
+  }
+
+  static uint64_t
+  hash64(uint32_t seed, const uint8_t* data, size_t len)
+  {
+    return static_cast<uint64_t>(MurmurHash3(seed, data, len)) << 32 |
+           MurmurHash3(seed + 1, data, len);
+  }
+};
+
+/**
+ * XXH64, one pass for 64 bits, 32-bit output is its low half.
+ */
+struct XXH64Hash
+{
+  static const uint8_t ID = HASH_XXH64;
+
+  static uint32_t
+  hash32(uint32_t seed, const uint8_t* data, size_t len)
+  {
+    return static_cast<uint32_t>(XXH64(data, len, seed));
+  }
+
+  static uint64_t
+  hash64(uint32_t seed, const uint8_t* data, size_t len)
+  {
+    return XXH64(data, len, seed);
+  }
+};
+
+#if PSYNC_HASH == 1
+typedef XXH64Hash DefaultHash;
+#else
+typedef Murmur3Hash DefaultHash;
+#endif
+
+inline bool
+isKnownHash(uint64_t id)
+{
+  return id == HASH_MURMUR3 || id == HASH_XXH64;
+}
+
+/**
+ * hash32() of the policy with the given id, for hashes chosen by a peer
+ * such as a consumer's bloom filter. Unknown ids fall back to MurmurHash3,
+ * check them with isKnownHash() first.
+ */
+inline uint32_t
+hash32(uint8_t id, uint32_t seed, const uint8_t* data, size_t len)
+{
+  if (id == HASH_XXH64) {
+    return XXH64Hash::hash32(seed, data, len);
+  }
+  return Murmur3Hash::hash32(seed, data, len);
+}
+
+}
+
+#endif
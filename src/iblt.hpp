@@ -2,59 +2,530 @@
 #define IBLT_H
 
 #include <inttypes.h>
+#include <cassert>
 #include <set>
-#include <vector>
+#include <sstream>
 #include <string>
+#include <type_traits>
+#include <vector>
+
+#include "arena.hpp"
+#include "hash_policy.hpp"
+
+// Configuration used for the IBLT typedef below, set by ./waf configure
+#ifndef PSYNC_IBLT_KEY_BITS
+#define PSYNC_IBLT_KEY_BITS 32
+#endif
+
+#ifndef PSYNC_IBLT_N_HASH
+#define PSYNC_IBLT_N_HASH 3
+#endif
 
 namespace psync {
 
-class HashTableEntry
+namespace iblt {
+
+uint64_t
+mix64(uint64_t x);
+
+template<typename T>
+inline void
+toBytes(T number, uint8_t* bytes)
+{
+  for (size_t i = 0; i < sizeof(T); i++) {
+    bytes[i] = (number >> i*8) & 0xff;
+  }
+}
+
+template<typename T>
+inline T
+fromBytes(const uint8_t* bytes)
+{
+  T number = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    number |= static_cast<T>(bytes[i]) << i*8;
+  }
+  return number;
+}
+
+/**
+ * Cells per hash function: 1.5x expectedNumEntries in total gives very
+ * low probability of decoding failure.
+ */
+constexpr size_t
+partitionSize(size_t expectedNumEntries, size_t nHash)
+{
+  return (expectedNumEntries + expectedNumEntries/2 + nHash - 1) / nHash;
+}
+
+// multiply-shift reduction of a 32-bit hash into [0, range)
+inline size_t
+reduce(uint32_t hash, size_t range)
+{
+  return (static_cast<uint64_t>(hash) * range) >> 32;
+}
+
+} // namespace iblt
+
+template<typename Key, uint32_t CheckSeed, typename Hash = Murmur3Hash>
+class BasicHashTableEntry
 {
 public:
   int32_t count;
-  uint32_t keySum;
+  Key keySum;
   uint32_t keyCheck;
 
-  bool isPure() const;
-  bool empty() const;
+  static uint32_t
+  check(Key key)
+  {
+    uint8_t bytes[sizeof(Key)];
+    iblt::toBytes(key, bytes);
+    return Hash::hash32(CheckSeed, bytes, sizeof(Key));
+  }
+
+  bool
+  isPure() const
+  {
+    if (count == 1 || count == -1) {
+      return keyCheck == check(keySum);
+    }
+    return false;
+  }
+
+  bool
+  empty() const
+  {
+    return (count == 0 && keySum == 0 && keyCheck == 0);
+  }
 };
 
-class IBLT
+/**
+ * Invertible bloom lookup table over fixed-width keys.
+ *
+ * Key is the key type (uint32_t or uint64_t), NHash the number of hash
+ * functions, each owning an equal partition of the table and seeded with
+ * its index, CheckSeed the seed of the per-cell key check hash, at least
+ * NHash, and Hash the hash policy, see hash_policy.hpp.
+ *
+ * The wire encoding starts with the key width, hash count, check seed and
+ * hash id so tables built with a different configuration are rejected on
+ * decode.
+ *
+ * The table can be placed in an Arena for per-interest temporaries; plain
+ * copies always go to the heap.
+ */
+template<typename KeyT, size_t NHash = 3, uint32_t CheckSeed = 11, typename Hash = Murmur3Hash>
+class BasicIBLT
 {
+  static_assert(std::is_unsigned<KeyT>::value && (sizeof(KeyT) == 4 || sizeof(KeyT) == 8),
+                "IBLT keys are 32 or 64-bit unsigned integers");
+  static_assert(NHash > 0 && NHash < 256, "IBLT needs 1 to 255 hash functions");
+  static_assert(CheckSeed < 256, "IBLT check seed is encoded in one byte");
+  static_assert(NHash <= CheckSeed, "IBLT bucket hashes use seeds 0 to NHash - 1, not the check seed");
+
 public:
-  IBLT(size_t _expectedNumEntries);
-  IBLT(const IBLT& other);
-  IBLT(size_t _expectedNumEntries, std::vector <uint32_t> values);
-  virtual ~IBLT();
+  typedef KeyT Key;
+  typedef Hash HashPolicy;
+  typedef BasicHashTableEntry<Key, CheckSeed, Hash> HashTableEntry;
+  typedef ArenaAllocator<HashTableEntry> allocator_type;
+  typedef std::vector<HashTableEntry, allocator_type> Table;
+
+  static const size_t N_HASH = NHash;
+  static const uint32_t N_HASHCHECK = CheckSeed;
+  static const size_t HEADER_SIZE = 4;
+  static const size_t CELL_SIZE = 4 + sizeof(Key) + 4;
+
+  static constexpr size_t
+  tableSize(size_t expectedNumEntries)
+  {
+    return NHash * iblt::partitionSize(expectedNumEntries, NHash);
+  }
+
+  /**
+   * Key for a name, e.g. "prefix/seq". 64-bit keys combine two seeds so
+   * large groups do not run into 32-bit collisions.
+   */
+  static Key
+  makeKey(const std::string& name);
 
-  void insert(uint32_t key);
-  void erase(uint32_t key);
-  bool listEntries(std::set<uint32_t>& positive, std::set<uint32_t>& negative);
-  IBLT operator-(const IBLT& other) const;
-  bool operator==(const IBLT& other) const;
+  BasicIBLT();
+  explicit BasicIBLT(const allocator_type& alloc);
+  explicit BasicIBLT(size_t expectedNumEntries, const allocator_type& alloc = allocator_type());
+  BasicIBLT(const BasicIBLT& other, const allocator_type& alloc);
+  BasicIBLT(const BasicIBLT& other) = default;
+  BasicIBLT(BasicIBLT&& other) = default;
+  BasicIBLT& operator=(const BasicIBLT& other) = default;
+  BasicIBLT& operator=(BasicIBLT&& other) = default;
+  virtual ~BasicIBLT() {}
 
-  std::vector <HashTableEntry>
-  getHashTable()
+  allocator_type
+  get_allocator() const
+  {
+    return hashTable.get_allocator();
+  }
+
+  void insert(Key key);
+  void erase(Key key);
+  /**
+   * Peel the table into keys with count 1 (positive) and -1 (negative).
+   *
+   * Returns true if the table peeled completely. On false, positive and
+   * negative still hold every key that was peeled before decoding stalled.
+   * Any set type of keys works; the peeling copy uses this table's
+   * allocator.
+   */
+  template<typename Set>
+  bool listEntries(Set& positive, Set& negative) const;
+  BasicIBLT operator-(const BasicIBLT& other) const;
+  BasicIBLT& operator-=(const BasicIBLT& other);
+  // add the keys of a table of the same size, e.g. one built on another thread
+  BasicIBLT& operator+=(const BasicIBLT& other);
+  bool operator==(const BasicIBLT& other) const;
+
+  std::vector<uint8_t> encode() const;
+
+  size_t
+  encodedSize() const
+  {
+    return HEADER_SIZE + CELL_SIZE * hashTable.size();
+  }
+
+  // write encodedSize() bytes to buf
+  void encode(uint8_t* buf) const;
+
+  /**
+   * Replace the table with an encoded one. Fails if the encoding was made
+   * with other parameters or, unless this table is empty, another size.
+   */
+  bool decode(const uint8_t* buf, size_t len);
+
+  const Table&
+  getHashTable() const
   {
     return hashTable; 
   }
 
   std::size_t
-  getNumEntry() {
+  getNumEntry() const {
     return hashTable.size();
   }
 
+  /**
+   * Digest of the table contents, maintained incrementally so it can name
+   * a repo state. Equal tables have equal digests.
+   */
+  uint64_t
+  getDigest() const
+  {
+    return stateDigest;
+  }
+
 public:
   // for debugging
   std::string DumpTable() const;
 
 private:
-  void _insert(int plusOrMinus, uint32_t key);
+  void _insert(int plusOrMinus, Key key);
+  void computeDigest();
+
+  static uint64_t
+  cellDigest(size_t index, const HashTableEntry& entry);
 
 private:
-  std::vector<HashTableEntry> hashTable;
+  Table hashTable;
+  size_t bucketsPerHash; // cells of each hash function's partition
+  uint64_t stateDigest;
 };
 
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+const size_t BasicIBLT<KeyT, NHash, CheckSeed, Hash>::N_HASH;
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+const uint32_t BasicIBLT<KeyT, NHash, CheckSeed, Hash>::N_HASHCHECK;
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+const size_t BasicIBLT<KeyT, NHash, CheckSeed, Hash>::HEADER_SIZE;
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+const size_t BasicIBLT<KeyT, NHash, CheckSeed, Hash>::CELL_SIZE;
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+typename BasicIBLT<KeyT, NHash, CheckSeed, Hash>::Key
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::makeKey(const std::string& name)
+{
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(name.data());
+  if (sizeof(Key) == 8) {
+    return static_cast<Key>(Hash::hash64(CheckSeed, bytes, name.size()));
+  }
+  return static_cast<Key>(Hash::hash32(CheckSeed, bytes, name.size()));
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::BasicIBLT()
+: bucketsPerHash(0)
+, stateDigest(0)
+{
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::BasicIBLT(const allocator_type& alloc)
+: hashTable(alloc)
+, bucketsPerHash(0)
+, stateDigest(0)
+{
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::BasicIBLT(size_t expectedNumEntries, const allocator_type& alloc)
+: hashTable(tableSize(expectedNumEntries), HashTableEntry(), alloc)
+, bucketsPerHash(iblt::partitionSize(expectedNumEntries, NHash))
+, stateDigest(0)
+{
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::BasicIBLT(const BasicIBLT& other, const allocator_type& alloc)
+: hashTable(other.hashTable, alloc)
+, bucketsPerHash(other.bucketsPerHash)
+, stateDigest(other.stateDigest)
+{
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+uint64_t
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::cellDigest(size_t index, const HashTableEntry& entry)
+{
+  // empty cells contribute 0
+  if (entry.empty())
+    return 0;
+
+  uint64_t h = iblt::mix64((static_cast<uint64_t>(index) << 32) ^ static_cast<uint32_t>(entry.count));
+  h = iblt::mix64(h ^ entry.keySum);
+  return iblt::mix64(h ^ (static_cast<uint64_t>(entry.keyCheck) << 32));
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+void
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::computeDigest()
+{
+  stateDigest = 0;
+  for (size_t i = 0; i < hashTable.size(); i++) {
+    stateDigest += cellDigest(i, hashTable[i]);
+  }
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+void
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::_insert(int plusOrMinus, Key key)
+{
+  uint8_t kvec[sizeof(Key)];
+  iblt::toBytes(key, kvec);
+  uint32_t check = Hash::hash32(CheckSeed, kvec, sizeof(Key));
+
+  for (size_t i = 0; i < NHash; i++) {
+    size_t index = i*bucketsPerHash + iblt::reduce(Hash::hash32(i, kvec, sizeof(Key)), bucketsPerHash);
+    HashTableEntry& entry = hashTable[index];
+    stateDigest -= cellDigest(index, entry);
+    entry.count += plusOrMinus;
+    entry.keySum ^= key;
+    entry.keyCheck ^= check;
+    stateDigest += cellDigest(index, entry);
+  }
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+void
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::insert(Key key)
+{
+  _insert(1, key);
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+void
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::erase(Key key)
+{
+  _insert(-1, key);
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+template<typename Set>
+bool
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::listEntries(Set& positive, Set& negative) const
+{
+  BasicIBLT peeled(*this, get_allocator());
+
+  size_t nErased = 0;
+  do {
+    nErased = 0;
+    for (size_t i = 0; i < peeled.hashTable.size(); i++) {
+      HashTableEntry& entry = peeled.hashTable[i];
+      if (entry.isPure()) {
+        if (entry.count == 1) {
+          positive.insert(entry.keySum);
+        }
+        else {
+          negative.insert(entry.keySum);
+        }
+        peeled._insert(-entry.count, entry.keySum);
+        ++nErased;
+      }
+    }
+  } while (nErased > 0);
+
+  // If any buckets for one of the hash functions is not empty,
+  // then we didn't peel them all:
+  for (size_t i = 0; i < peeled.hashTable.size(); i++) {
+    if (peeled.hashTable[i].empty() != true) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::operator-(const BasicIBLT& other) const
+{
+  BasicIBLT result(*this);
+  result -= other;
+  return result;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>&
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::operator-=(const BasicIBLT& other)
+{
+  assert(hashTable.size() == other.hashTable.size());
+
+  for (size_t i = 0; i < hashTable.size(); i++) {
+    HashTableEntry& e1 = hashTable[i];
+    const HashTableEntry& e2 = other.hashTable[i];
+    e1.count -= e2.count;
+    e1.keySum ^= e2.keySum;
+    e1.keyCheck ^= e2.keyCheck;
+  }
+  computeDigest();
+
+  return *this;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>&
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::operator+=(const BasicIBLT& other)
+{
+  assert(hashTable.size() == other.hashTable.size());
+
+  for (size_t i = 0; i < hashTable.size(); i++) {
+    HashTableEntry& e1 = hashTable[i];
+    const HashTableEntry& e2 = other.hashTable[i];
+    e1.count += e2.count;
+    e1.keySum ^= e2.keySum;
+    e1.keyCheck ^= e2.keyCheck;
+  }
+  computeDigest();
+
+  return *this;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+bool
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::operator==(const BasicIBLT& other) const
+{
+  if (this->hashTable.size() != other.hashTable.size())
+    return false;
+
+  for (size_t i = 0; i < hashTable.size(); i++) {
+    if (this->hashTable[i].count != other.hashTable[i].count ||
+        this->hashTable[i].keySum != other.hashTable[i].keySum ||
+        this->hashTable[i].keyCheck != other.hashTable[i].keyCheck)
+      return false;
+  }
+
+  return true;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+std::vector<uint8_t>
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::encode() const
+{
+  std::vector<uint8_t> table(encodedSize());
+  encode(table.data());
+  return table;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+void
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::encode(uint8_t* buf) const
+{
+  buf[0] = sizeof(Key);
+  buf[1] = NHash;
+  buf[2] = CheckSeed;
+  buf[3] = Hash::ID;
+
+  uint8_t* cell = buf + HEADER_SIZE;
+  for (size_t i = 0; i < hashTable.size(); i++, cell += CELL_SIZE) {
+    iblt::toBytes(static_cast<uint32_t>(hashTable[i].count), cell);
+    iblt::toBytes(hashTable[i].keySum, cell + 4);
+    iblt::toBytes(hashTable[i].keyCheck, cell + 4 + sizeof(Key));
+  }
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+bool
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::decode(const uint8_t* buf, size_t len)
+{
+  if (len < HEADER_SIZE || buf[0] != sizeof(Key) || buf[1] != NHash || buf[2] != CheckSeed ||
+      buf[3] != Hash::ID) {
+    return false;
+  }
+
+  size_t nEntries = (len - HEADER_SIZE) / CELL_SIZE;
+  if (HEADER_SIZE + nEntries * CELL_SIZE != len || nEntries % NHash != 0 ||
+      (!hashTable.empty() && nEntries != hashTable.size())) {
+    return false;
+  }
+
+  hashTable.resize(nEntries);
+  bucketsPerHash = nEntries / NHash;
+  const uint8_t* cell = buf + HEADER_SIZE;
+  for (size_t i = 0; i < nEntries; i++, cell += CELL_SIZE) {
+    hashTable[i].count = static_cast<int32_t>(iblt::fromBytes<uint32_t>(cell));
+    hashTable[i].keySum = iblt::fromBytes<Key>(cell + 4);
+    hashTable[i].keyCheck = iblt::fromBytes<uint32_t>(cell + 4 + sizeof(Key));
+  }
+  computeDigest();
+
+  return true;
+}
+
+template<typename KeyT, size_t NHash, uint32_t CheckSeed, typename Hash>
+std::string
+BasicIBLT<KeyT, NHash, CheckSeed, Hash>::DumpTable() const
+{
+  std::ostringstream result;
+
+  result << "count keySum keyCheckMatch\n";
+  for (size_t i = 0; i < hashTable.size(); i++) {
+    const HashTableEntry& entry = hashTable[i];
+    result << entry.count << " " << entry.keySum << " ";
+    result << ((HashTableEntry::check(entry.keySum) == entry.keyCheck) ||
+              (entry.empty())? "true" : "false");
+    result << "\n";
+  }
+
+  return result.str();
+}
+
+extern template class BasicIBLT<uint32_t, 3>;
+extern template class BasicIBLT<uint64_t, 3>;
+extern template class BasicIBLT<uint32_t, 3, 11, XXH64Hash>;
+extern template class BasicIBLT<uint64_t, 3, 11, XXH64Hash>;
+
+typedef std::conditional<PSYNC_IBLT_KEY_BITS == 64, uint64_t, uint32_t>::type IbltKey;
+typedef BasicIBLT<IbltKey, PSYNC_IBLT_N_HASH, 11, DefaultHash> IBLT;
+typedef IBLT::HashTableEntry HashTableEntry;
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,124 @@
+#include "iblt_tree.hpp"
+
+#include <algorithm>
+
+namespace psync {
+
+const size_t IBLTTree::DIGEST_SIZE;
+
+// leaves are picked with a seed none of the IBLT hashes use, so the cells
+// a key takes inside its leaf do not depend on the leaf
+static const uint32_t LEAF_SEED = 0x100;
+
+IBLTTree::IBLTTree(size_t fanout, size_t depth, size_t leafEntries)
+: m_fanout(std::max<size_t>(fanout, 2))
+, m_depth(depth)
+, m_leafEntries(leafEntries)
+{
+  size_t width = 1;
+  for (size_t level = 0; level <= m_depth; level++) {
+    m_digests.push_back(std::vector<uint64_t>(width, 0));
+    if (level < m_depth) {
+      width *= m_fanout;
+    }
+  }
+  m_leaves.assign(width, IBLT(m_leafEntries));
+}
+
+void
+IBLTTree::insert(Key key)
+{
+  size_t leaf = getLeaf(key);
+  uint64_t oldDigest = m_digests[m_depth][leaf];
+  m_leaves[leaf].insert(key);
+  updateDigests(leaf, oldDigest);
+}
+
+void
+IBLTTree::erase(Key key)
+{
+  size_t leaf = getLeaf(key);
+  uint64_t oldDigest = m_digests[m_depth][leaf];
+  m_leaves[leaf].erase(key);
+  updateDigests(leaf, oldDigest);
+}
+
+size_t
+IBLTTree::getLeaf(Key key) const
+{
+  uint8_t bytes[sizeof(Key)];
+  iblt::toBytes(key, bytes);
+  return iblt::reduce(IBLT::HashPolicy::hash32(LEAF_SEED, bytes, sizeof(Key)), m_leaves.size());
+}
+
+std::vector<uint8_t>
+IBLTTree::encodeChildDigests(size_t level, size_t index) const
+{
+  std::vector<uint8_t> digests(m_fanout * DIGEST_SIZE);
+  const std::vector<uint64_t>& children = m_digests[level + 1];
+  for (size_t i = 0; i < m_fanout; i++) {
+    iblt::toBytes(children[index * m_fanout + i], &digests[i * DIGEST_SIZE]);
+  }
+  return digests;
+}
+
+bool
+IBLTTree::getDifferingChildren(size_t level, size_t index, const uint8_t* digests, size_t len,
+                               std::vector<size_t>& children) const
+{
+  if (len != m_fanout * DIGEST_SIZE) {
+    return false;
+  }
+
+  const std::vector<uint64_t>& ours = m_digests[level + 1];
+  for (size_t i = 0; i < m_fanout; i++) {
+    size_t child = index * m_fanout + i;
+    if (ours[child] != iblt::fromBytes<uint64_t>(digests + i * DIGEST_SIZE)) {
+      children.push_back(child);
+    }
+  }
+  return true;
+}
+
+bool
+IBLTTree::setLeafTable(size_t leaf, const uint8_t* buf, size_t len)
+{
+  IBLT table(m_leafEntries);
+  if (!table.decode(buf, len)) {
+    return false;
+  }
+
+  uint64_t oldDigest = m_digests[m_depth][leaf];
+  m_leaves[leaf] = std::move(table);
+  updateDigests(leaf, oldDigest);
+  return true;
+}
+
+uint64_t
+IBLTTree::leafDigest(size_t leaf, const IBLT& table)
+{
+  // mixed with the leaf index so that keys moving between ranges change
+  // the digests above them
+  if (table.getDigest() == 0) {
+    return 0;
+  }
+  return iblt::mix64(table.getDigest() ^ iblt::mix64(leaf + 1));
+}
+
+void
+IBLTTree::updateDigests(size_t leaf, uint64_t oldDigest)
+{
+  uint64_t newDigest = leafDigest(leaf, m_leaves[leaf]);
+  m_digests[m_depth][leaf] = newDigest;
+
+  // digests of internal nodes are sums over their leaves, so one change
+  // is applied to each ancestor instead of recomputing them
+  uint64_t delta = newDigest - oldDigest;
+  size_t index = leaf;
+  for (size_t level = m_depth; level-- > 0;) {
+    index /= m_fanout;
+    m_digests[level][index] += delta;
+  }
+}
+
+}
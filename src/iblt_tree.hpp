@@ -0,0 +1,128 @@
+#ifndef IBLT_TREE_HPP
+#define IBLT_TREE_HPP
+
+#include "iblt.hpp"
+
+#include <cstddef>
+#include <inttypes.h>
+#include <vector>
+
+namespace psync {
+
+/**
+ * Tree of IBLTs over hash ranges of the keys, for groups too large for
+ * one table to cover the differences a consumer can fall behind by.
+ *
+ * Keys are spread over fanout^depth leaves, each a small IBLT of the keys
+ * in its range. Every node, leaves included, has a digest, and the nodes
+ * of level l < depth have fanout children at level l + 1; the root is
+ * level 0, index 0. Two trees with the same shape and equal digests at a
+ * node hold the same keys below it, so a consumer compares child digests
+ * from the root down and peels only the leaves that differ.
+ *
+ * A consumer does not see every key, so it keeps the leaf tables the repo
+ * sends with its replies in place of its own, through setLeafTable().
+ */
+class IBLTTree
+{
+public:
+  typedef IBLT::Key Key;
+
+  static const size_t DIGEST_SIZE = 8;
+
+  IBLTTree(size_t fanout, size_t depth, size_t leafEntries);
+
+  void
+  insert(Key key);
+
+  void
+  erase(Key key);
+
+  size_t
+  getLeaf(Key key) const;
+
+  size_t
+  getFanout() const
+  {
+    return m_fanout;
+  }
+
+  size_t
+  getDepth() const
+  {
+    return m_depth;
+  }
+
+  size_t
+  getLeafEntries() const
+  {
+    return m_leafEntries;
+  }
+
+  size_t
+  getNumLeaves() const
+  {
+    return m_leaves.size();
+  }
+
+  // nodes at level, fanout^level
+  size_t
+  getWidth(size_t level) const
+  {
+    return m_digests[level].size();
+  }
+
+  // digest of a node, 0 if no key is below it
+  uint64_t
+  getDigest(size_t level, size_t index) const
+  {
+    return m_digests[level][index];
+  }
+
+  /**
+   * Digests of the children of an internal node, DIGEST_SIZE bytes each,
+   * little-endian.
+   */
+  std::vector<uint8_t>
+  encodeChildDigests(size_t level, size_t index) const;
+
+  /**
+   * Children of an internal node whose digest differs from the encoded
+   * ones of another tree. Returns false if digests has the wrong size.
+   */
+  bool
+  getDifferingChildren(size_t level, size_t index, const uint8_t* digests, size_t len,
+                       std::vector<size_t>& children) const;
+
+  const IBLT&
+  getLeafTable(size_t leaf) const
+  {
+    return m_leaves[leaf];
+  }
+
+  /**
+   * Replace a leaf with an encoded table of another tree of this shape.
+   * Returns false, leaving the leaf unchanged, if the table does not fit.
+   */
+  bool
+  setLeafTable(size_t leaf, const uint8_t* buf, size_t len);
+
+private:
+  // contribution of a leaf to the digests of its ancestors
+  static uint64_t
+  leafDigest(size_t leaf, const IBLT& table);
+
+  void
+  updateDigests(size_t leaf, uint64_t oldDigest);
+
+private:
+  size_t m_fanout;
+  size_t m_depth;
+  size_t m_leafEntries;
+  std::vector <IBLT> m_leaves;
+  std::vector <std::vector <uint64_t>> m_digests; // by level, leaves at m_depth
+};
+
+}
+
+#endif
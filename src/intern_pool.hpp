@@ -0,0 +1,80 @@
+#ifndef INTERN_POOL_HPP
+#define INTERN_POOL_HPP
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+namespace psync {
+
+/**
+ * Content-addressed pool of immutable objects: equal values share one
+ * reference-counted instance. The pool only holds weak references, an
+ * object goes away with its last user and its slot is swept later.
+ *
+ * Hash maps a value to its address, equal values by operator== share
+ * one. Not thread-safe, but the interned objects may be released on
+ * any thread.
+ */
+template<typename T, typename Hash>
+class InternPool
+{
+public:
+  InternPool()
+  : m_sweepAt(MIN_SWEEP)
+  {
+  }
+
+  /**
+   * The pooled object equal to *value, or value itself after adding it.
+   */
+  std::shared_ptr<const T>
+  intern(const std::shared_ptr<const T>& value)
+  {
+    std::size_t hash = Hash()(*value);
+    auto range = m_objects.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      std::shared_ptr<const T> pooled = it->second.lock();
+      if (pooled != nullptr && *pooled == *value)
+        return pooled;
+    }
+
+    if (m_objects.size() >= m_sweepAt)
+      sweep();
+    m_objects.insert(std::make_pair(hash, std::weak_ptr<const T>(value)));
+    return value;
+  }
+
+  // objects tracked, including released ones not swept yet
+  std::size_t
+  size() const
+  {
+    return m_objects.size();
+  }
+
+private:
+  void
+  sweep()
+  {
+    for (auto it = m_objects.begin(); it != m_objects.end();) {
+      if (it->second.expired())
+        it = m_objects.erase(it);
+      else
+        ++it;
+    }
+    m_sweepAt = std::max(MIN_SWEEP, 2 * m_objects.size());
+  }
+
+private:
+  static const std::size_t MIN_SWEEP = 64;
+
+  std::unordered_multimap <std::size_t, std::weak_ptr<const T> > m_objects;
+  std::size_t m_sweepAt; // pool size that triggers the next sweep
+};
+
+template<typename T, typename Hash>
+const std::size_t InternPool<T, Hash>::MIN_SWEEP;
+
+}
+
+#endif
@@ -1,4 +1,16 @@
 #include "logic_consumer.hpp"
+#include "iblt.hpp"
+#include "iblt_tree.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <ndn-cxx/util/time.hpp>
 
@@ -8,6 +20,110 @@ namespace pt = boost::posix_time;
 
 namespace psync{
 
+ConsumerMetrics::ConsumerMetrics()
+: helloSent(counter("hello_sent"))
+, helloDeltas(counter("hello_deltas"))
+, syncSent(counter("sync_sent"))
+, syncTimeouts(counter("sync_timeouts"))
+, nacks(counter("nacks"))
+, partialReplies(counter("partial_replies"))
+, treeDescents(counter("tree_descents"))
+, updates(counter("updates"))
+, syncPauses(counter("sync_pauses"))
+, syncRtt(histogram("sync_rtt_us"))
+, dataFetchRtt(histogram("data_fetch_rtt_us"))
+{
+}
+
+// State file: magic, then little-endian fields, then a MurmurHash3 of
+// everything before it.
+//   count u32, fp*1000 u32,
+//   partitions u32, each: sync prefix length u16, URI bytes, flags u8,
+//     hello epoch u64, hello version u64, IBLT size u32, IBLT bytes
+//   prefixes u32, each: length u16, bytes, seq u32, in m_ns u8
+//   subscriptions u32, each: length u16, bytes
+static const char STATE_MAGIC[8] = {'P', 'S', 'C', 'S', 'T', 'A', 'T', '2'};
+static const uint8_t STATE_HAS_HELLO_VERSION = 0x01;
+
+template<typename T>
+static void
+putNumber(std::string& out, T number)
+{
+  uint8_t bytes[sizeof(T)];
+  iblt::toBytes(number, bytes);
+  out.append(reinterpret_cast<const char*>(bytes), sizeof(T));
+}
+
+// false if size does not fit T, the field would load as garbage under a
+// checksum that still matches
+template<typename T>
+static bool
+putBytes(std::string& out, const void* data, std::size_t size)
+{
+  if (size > std::numeric_limits<T>::max())
+    return false;
+  putNumber<T>(out, size);
+  out.append(static_cast<const char*>(data), size);
+  return true;
+}
+
+// bounds-checked reads from the mapped file
+class StateReader
+{
+public:
+  StateReader(const uint8_t* data, std::size_t size)
+  : m_pos(data)
+  , m_end(data + size)
+  {}
+
+  template<typename T>
+  bool
+  getNumber(T& number)
+  {
+    if (static_cast<std::size_t>(m_end - m_pos) < sizeof(T))
+      return false;
+    number = iblt::fromBytes<T>(m_pos);
+    m_pos += sizeof(T);
+    return true;
+  }
+
+  template<typename T>
+  bool
+  getBytes(const uint8_t*& data, std::size_t& size)
+  {
+    T length;
+    if (!getNumber(length) || static_cast<std::size_t>(m_end - m_pos) < length)
+      return false;
+    data = m_pos;
+    size = length;
+    m_pos += length;
+    return true;
+  }
+
+  template<typename T>
+  bool
+  getString(std::string& str)
+  {
+    const uint8_t* data;
+    std::size_t size;
+    if (!getBytes<T>(data, size))
+      return false;
+    str.assign(reinterpret_cast<const char*>(data), size);
+    return true;
+  }
+
+private:
+  const uint8_t* m_pos;
+  const uint8_t* m_end;
+};
+
+static uint64_t
+microsecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - start).count();
+}
+
 LogicConsumer::LogicConsumer(ndn::Name& prefix,
                              ndn::Face& face,
                              RecieveHelloCallback& onRecieveHelloData,
@@ -22,59 +138,131 @@ LogicConsumer::LogicConsumer(ndn::Name& prefix,
 , m_false_positive(false_positve)
 , m_suball(false_positve == 0.001 && m_count == 1)
 , m_helloSent(false)
+, m_treeFanout(0)
+, m_treeDepth(0)
+, m_treeLeafEntries(0)
+, m_scheduler(m_face.getIoService())
+, m_savePeriod(0)
+, m_isStateDirty(false)
 {
-  bloom_parameters opt;
-  opt.false_positive_probability = m_false_positive;
-  opt.projected_element_count = m_count;
-  opt.compute_optimal_parameters();
-  m_bf = bloom_filter(opt);
+  m_partitions[m_syncPrefix].bf = makeBF();
 }
 
 LogicConsumer::~LogicConsumer()
 {
+  if (m_isStateDirty)
+    saveState();
   m_face.shutdown();
 }
 
 void
 LogicConsumer::stop()
 {
+  if (m_isStateDirty)
+    saveState();
   m_face.shutdown();
 }
 
 void
 LogicConsumer::sendHelloInterest()
 {
-  ndn::Name helloInterestName = m_syncPrefix;
+  for (const auto& partition : m_partitions) {
+    sendHelloInterest(partition.first);
+  }
+}
+
+void
+LogicConsumer::sendHelloInterest(const ndn::Name& partition)
+{
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr) {
+    return;
+  }
+
+  ndn::Name helloInterestName = partition;
   helloInterestName.append("hello");
+  if (state->helloSent && state->hasHelloVersion) {
+    helloInterestName.appendNumber(state->helloEpoch);
+    helloInterestName.appendNumber(state->helloVersion);
+  }
 
   ndn::Interest helloInterest(helloInterestName);
   helloInterest.setInterestLifetime(ndn::time::milliseconds(1000));
   helloInterest.setMustBeFresh(true);
 
+  m_metrics.helloSent.increment();
   m_face.expressInterest(helloInterest,
-                           bind(&LogicConsumer::onHelloData, this, _1, _2),
-                           bind(&LogicConsumer::onHelloTimeout, this, _1));
+                           bind(&LogicConsumer::onHelloData, this, partition, _2),
+                           bind(&LogicConsumer::onHelloTimeout, this, partition));
 }
 
 void
 LogicConsumer::sendSyncInterest()
 {
-  // name last component is the IBF and content should be the prefix with the version numbers
-  assert(m_helloSent);
-  assert(!m_iblt.empty());
+  for (const auto& partition : m_partitions) {
+    sendSyncInterest(partition.first);
+  }
+}
 
-  ndn::Name syncInterestName = m_syncPrefix;
-  syncInterestName.append("sync");
-  appendBF(syncInterestName);
-  syncInterestName.append(m_iblt);
+void
+LogicConsumer::sendSyncInterest(const ndn::Name& partition)
+{
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr) {
+    return;
+  }
+  // joined after the first hello, or missing from a loaded state file
+  if (!state->helloSent) {
+    sendHelloInterest(partition);
+    return;
+  }
+  // the application is behind, onStreamDrained() sends it later
+  if (m_stream != nullptr && m_stream->checkFull()) {
+    if (!state->isSyncPaused) {
+      m_metrics.syncPauses.increment();
+    }
+    state->isSyncPaused = true;
+    return;
+  }
+  // the repo's keys can only be rebuilt with the same IBLT configuration
+  if (m_treeFanout != 0 && state->isIBLTKnown) {
+    if (state->tree == nullptr) {
+      buildTree(partition, *state);
+    }
+    // a new round, whatever the last one still waits for
+    ++state->treeRound;
+    state->nTreeRequests = 0;
+    m_metrics.syncSent.increment();
+    sendTreeInterest(partition, 0, 0);
+    return;
+  }
+
+  // name last component is the IBF and content should be the prefix with the version numbers
+  assert(!state->iblt.empty());
+
+  // name the last-known state by its digest while the repo still has it
+  // in its history, the full IBLT is only needed once it has aged out
+  ndn::Name syncInterestName = partition;
+  if (state->digestMiss) {
+    syncInterestName.append("sync");
+    appendBF(syncInterestName, state->bf);
+    syncInterestName.append(state->iblt);
+  }
+  else {
+    syncInterestName.append("digest");
+    appendBF(syncInterestName, state->bf);
+    syncInterestName.appendNumber(state->ibltDigest);
+  }
 
   ndn::Interest syncInterest(syncInterestName);
   syncInterest.setInterestLifetime(ndn::time::milliseconds(1000));
   syncInterest.setMustBeFresh(true);
 
+  m_metrics.syncSent.increment();
+  state->syncSentTime = std::chrono::steady_clock::now();
   m_face.expressInterest(syncInterest,
-                           bind(&LogicConsumer::onSyncData, this, _1, _2),
-                           bind(&LogicConsumer::onSyncTimeout, this, _1));
+                           bind(&LogicConsumer::onSyncData, this, partition, _2),
+                           bind(&LogicConsumer::onSyncTimeout, this, partition));
 }
 
 void
@@ -87,6 +275,7 @@ LogicConsumer::fetchData(const ndn::Name& sessionName, const uint32_t& seq)
   ndn::Interest interest(interestName);
   interest.setMustBeFresh(true);
 
+  m_fetchTimes[interestName] = std::chrono::steady_clock::now();
   m_face.expressInterest(interest,
                          bind(&LogicConsumer::onData, this, _1, _2),
                          bind(&LogicConsumer::onDataTimeout, this, _1));
@@ -108,7 +297,11 @@ void
 LogicConsumer::addSL(std::string s)
 {
   m_sl.insert(s);
-  m_bf.insert(s);
+  ConsumerPartition* state = findPartition(getOwner(s));
+  if (state != nullptr) {
+    state->bf.insert(s);
+  }
+  m_isStateDirty = true;
 }
 
 std::vector <std::string>
@@ -118,10 +311,23 @@ LogicConsumer::getNS()
 }
 
 void
-LogicConsumer::onHelloData(const ndn::Interest& interest, const ndn::Data& data)
+LogicConsumer::onHelloData(const ndn::Name& partition, const ndn::Data& data)
 {
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr) {
+    return;
+  }
+
   ndn::Name helloDataName = data.getName();
-  m_iblt = helloDataName.getSubName(helloDataName.size()-2, 2);
+  setIBLT(*state, helloDataName.getSubName(helloDataName.size()-2, 2));
+  // rebuilt from the prefixes before the next sync
+  state->tree.reset();
+  // hello[/<epoch>/<version>]/<epoch>/<version>/<IBLT size>/<IBLT>
+  if (helloDataName.size() >= partition.size() + 5) {
+    state->helloEpoch = helloDataName.get(-4).toNumber();
+    state->helloVersion = helloDataName.get(-3).toNumber();
+    state->hasHelloVersion = true;
+  }
   std::string content(reinterpret_cast<const char*>(data.getContent().value()),
                         data.getContent().value_size());
 
@@ -129,21 +335,73 @@ LogicConsumer::onHelloData(const ndn::Interest& interest, const ndn::Data& data)
   std::string prefix;
   uint32_t seq;
 
+  if (m_helloSent) {
+    // re-hello after a NACK, or the first hello of a partition that
+    // joined: report what advanced and resume syncing. A delta only lists
+    // what changed since helloVersion, removed prefixes with a leading "-".
+    std::vector <MissingData> updates;
+    bool isDelta = false;
+    while (ss >> prefix >> seq) {
+      if (prefix == "DELTA") {
+        isDelta = true;
+        m_metrics.helloDeltas.increment();
+        continue;
+      }
+      if (isDelta && prefix[0] == '-') {
+        prefix.erase(0, 1);
+        m_prefixes.erase(prefix);
+        m_ns.erase(std::remove(m_ns.begin(), m_ns.end(), prefix), m_ns.end());
+        continue;
+      }
+
+      auto it = m_prefixes.find(prefix);
+      if (it == m_prefixes.end()) {
+        m_ns.push_back(prefix);
+        m_prefixes[prefix] = seq;
+      }
+      else if (it->second < seq) {
+        if (isSub(prefix))
+          addUpdate(updates, prefix, it->second, seq);
+        it->second = seq;
+      }
+    }
+
+    deliverUpdates(updates);
+
+    state->helloSent = true;
+    m_isStateDirty = true;
+    this->sendSyncInterest(partition);
+    return;
+  }
+
   while (ss >> prefix >> seq) {
+    if (m_prefixes.find(prefix) == m_prefixes.end())
+      m_ns.push_back(prefix);
     m_prefixes[prefix] = seq;
-    m_ns.push_back(prefix);
   }
+  state->helloSent = true;
 
+  // the application syncs once every partition has answered
+  for (const auto& p : m_partitions) {
+    if (!p.second.helloSent)
+      return;
+  }
   m_helloSent = true;
+  m_isStateDirty = true;
 
   m_onRecieveHelloData();
 }
 
 void
-LogicConsumer::onSyncData(const ndn::Interest& interest, const ndn::Data& data)
+LogicConsumer::onSyncData(const ndn::Name& partition, const ndn::Data& data)
 {
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr) {
+    return;
+  }
+
   ndn::Name syncDataName = data.getName();
-  m_iblt = syncDataName.getSubName(syncDataName.size()-2, 2);
+  m_metrics.syncRtt.record(microsecondsSince(state->syncSentTime));
 
   std::string content(reinterpret_cast<const char*>(data.getContent().value()),
                         data.getContent().value_size());
@@ -154,45 +412,345 @@ LogicConsumer::onSyncData(const ndn::Interest& interest, const ndn::Data& data)
   std::vector <MissingData> updates;
 
   while (ss >> prefix >> seq) {
+    if (prefix == "NACK") {
+      // the repo could not decode our IBLT at all
+      m_metrics.nacks.increment();
+      this->sendHelloInterest(partition);
+      return;
+    }
+    if (prefix == "MISS") {
+      state->digestMiss = true;
+      this->sendSyncInterest(partition);
+      return;
+    }
+    if (prefix == "CONTINUE") {
+      // partial reply, the next sync interest picks up the remainder
+      // and gets a NACK if the repo cannot peel any of it
+      m_metrics.partialReplies.increment();
+      continue;
+    }
     if (m_prefixes.find(prefix) == m_prefixes.end() || m_prefixes[prefix] < seq) {
-      updates.push_back(MissingData(prefix, m_prefixes[prefix], seq));
+      m_metrics.updates.increment();
+      addUpdate(updates, prefix, m_prefixes[prefix], seq);
       m_prefixes[prefix] = seq;
     }
   }
 
-  if (!updates.empty())
-    m_onUpdate(updates);
+  setIBLT(*state, syncDataName.getSubName(syncDataName.size()-2, 2));
+  m_isStateDirty = true;
+
+  deliverUpdates(updates);
+
+  this->sendSyncInterest(partition);
+}
+
+void
+LogicConsumer::onHelloTimeout(const ndn::Name& partition)
+{
+  this->sendHelloInterest(partition);
+}
+
+void
+LogicConsumer::onSyncTimeout(const ndn::Name& partition)
+{
+  m_metrics.syncTimeouts.increment();
+  this->sendSyncInterest(partition);
+}
 
-  this->sendSyncInterest();
+void
+LogicConsumer::setTreeSync(std::size_t fanout, std::size_t depth, std::size_t leafEntries)
+{
+  m_treeFanout = std::max<std::size_t>(fanout, 2);
+  m_treeDepth = depth;
+  m_treeLeafEntries = leafEntries;
+  for (auto& partition : m_partitions) {
+    partition.second.tree.reset();
+  }
 }
 
 void
-LogicConsumer::onHelloTimeout(const ndn::Interest& interest)
+LogicConsumer::sendTreeInterest(const ndn::Name& partition, std::size_t level, std::size_t index)
 {
-  this->sendHelloInterest();
+  ConsumerPartition& state = m_partitions[partition];
+  ++state.nTreeRequests;
+  if (level > 0) {
+    m_metrics.treeDescents.increment();
+  }
+  expressTreeInterest(partition, state.treeRound, level, index);
 }
 
 void
-LogicConsumer::onSyncTimeout(const ndn::Interest& interest)
+LogicConsumer::expressTreeInterest(const ndn::Name& partition, uint64_t round,
+                                   std::size_t level, std::size_t index)
 {
-  this->sendSyncInterest();
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr || state->treeRound != round) {
+    return;
+  }
+
+  // <tree>/<fanout>/<depth>/<leaf entries>/<hash id>/<BF>/<level>/<index>/<payload>
+  ndn::Name treeInterestName = partition;
+  treeInterestName.append("tree");
+  treeInterestName.appendNumber(m_treeFanout);
+  treeInterestName.appendNumber(m_treeDepth);
+  treeInterestName.appendNumber(m_treeLeafEntries);
+  appendBF(treeInterestName, state->bf);
+  treeInterestName.appendNumber(level);
+  treeInterestName.appendNumber(index);
+  if (level == m_treeDepth) {
+    std::vector<uint8_t> table = state->tree->getLeafTable(index).encode();
+    treeInterestName.append(table.begin(), table.end());
+  }
+  else {
+    std::vector<uint8_t> digests = state->tree->encodeChildDigests(level, index);
+    treeInterestName.append(digests.begin(), digests.end());
+  }
+
+  ndn::Interest treeInterest(treeInterestName);
+  treeInterest.setInterestLifetime(ndn::time::milliseconds(1000));
+  treeInterest.setMustBeFresh(true);
+
+  if (level == 0) {
+    state->syncSentTime = std::chrono::steady_clock::now();
+  }
+  m_face.expressInterest(treeInterest,
+                         bind(&LogicConsumer::onTreeData, this, partition, round, level, index, _2),
+                         bind(&LogicConsumer::onTreeTimeout, this, partition, round, level, index));
 }
 
 void
-LogicConsumer::appendBF(ndn::Name& name)
+LogicConsumer::onTreeData(const ndn::Name& partition, uint64_t round,
+                          std::size_t level, std::size_t index, const ndn::Data& data)
 {
+  ConsumerPartition* state = findPartition(partition);
+  if (state == nullptr || state->treeRound != round) {
+    return;
+  }
+  if (level == 0) {
+    m_metrics.syncRtt.record(microsecondsSince(state->syncSentTime));
+  }
+
+  std::string content(reinterpret_cast<const char*>(data.getContent().value()),
+                        data.getContent().value_size());
+
+  std::stringstream ss(content);
+  std::string prefix;
+  uint32_t seq;
+  std::vector <MissingData> updates;
+  std::vector <std::size_t> children;
+
+  while (ss >> prefix >> seq) {
+    if (prefix == "NACK") {
+      // the repo has a tree of another shape, or none
+      m_metrics.nacks.increment();
+      this->sendHelloInterest(partition);
+      return;
+    }
+    if (prefix == "DIFF") {
+      children.push_back(seq);
+      continue;
+    }
+    if (m_prefixes.find(prefix) == m_prefixes.end() || m_prefixes[prefix] < seq) {
+      m_metrics.updates.increment();
+      addUpdate(updates, prefix, m_prefixes[prefix], seq);
+      m_prefixes[prefix] = seq;
+    }
+  }
+
+  if (level == m_treeDepth) {
+    const ndn::name::Component& table = data.getName().get(-1);
+    state->tree->setLeafTable(index, table.value(), table.value_size());
+    m_isStateDirty = true;
+  }
+  for (auto child : children) {
+    if (level < m_treeDepth && child < state->tree->getWidth(level + 1)) {
+      sendTreeInterest(partition, level + 1, child);
+    }
+  }
+
+  deliverUpdates(updates);
+
+  finishTreeRequest(partition);
+}
+
+void
+LogicConsumer::onTreeTimeout(const ndn::Name& partition, uint64_t round,
+                             std::size_t level, std::size_t index)
+{
+  m_metrics.syncTimeouts.increment();
+  expressTreeInterest(partition, round, level, index);
+}
+
+void
+LogicConsumer::finishTreeRequest(const ndn::Name& partition)
+{
+  // the application may have changed the partitions on an update
+  ConsumerPartition* state = findPartition(partition);
+  if (state != nullptr && --state->nTreeRequests == 0) {
+    this->sendSyncInterest(partition);
+  }
+}
+
+void
+LogicConsumer::buildTree(const ndn::Name& partition, ConsumerPartition& state)
+{
+  // The tree the repo had when it listed these prefixes. Prefixes not
+  // subscribed to are not kept current, their leaves differ and are
+  // replaced by the repo's tables in the first rounds.
+  state.tree = std::make_shared<IBLTTree>(m_treeFanout, m_treeDepth, m_treeLeafEntries);
+  for (const auto& p : m_prefixes) {
+    if (p.second != 0 && getOwner(p.first) == partition) {
+      state.tree->insert(IBLT::makeKey(p.first + "/" + std::to_string(p.second)));
+    }
+  }
+}
+
+void
+LogicConsumer::appendBF(ndn::Name& name, bloom_filter& bf)
+{
+  // the repo hashes prefixes with the function of the filter, whatever
+  // its own tables use
+  name.appendNumber(bf.shape()->hash_id);
   name.appendNumber(m_count);
   name.appendNumber((int)(m_false_positive*1000));
-  name.appendNumber(m_bf.getTableSize());
-  name.append(m_bf.begin(), m_bf.end());
-  ndn::name::Component comp = name.get(name.size()-1);
-  std::vector <uint8_t> table(comp.begin(), comp.end()); 
+  name.appendNumber(bf.getTableSize());
+  name.append(bf.begin(), bf.end());
+}
+
+void
+LogicConsumer::setIBLT(ConsumerPartition& partition, const ndn::Name& ibltName)
+{
+  partition.iblt = ibltName;
+  const ndn::name::Component& table = partition.iblt.get(1);
+  IBLT iblt;
+  partition.isIBLTKnown = iblt.decode(table.value(), table.value_size());
+  partition.ibltDigest = partition.isIBLTKnown ? iblt.getDigest() : 0;
+  // the digest of a table from a repo with other IBLT parameters or hash
+  // cannot be computed here, the table itself names the state
+  partition.digestMiss = !partition.isIBLTKnown;
+}
+
+void
+LogicConsumer::addUpdate(std::vector<MissingData>& updates, const std::string& prefix,
+                         uint32_t seq1, uint32_t seq2)
+{
+  if (m_stream != nullptr) {
+    m_stream->push(m_stream->intern(prefix), seq1, seq2);
+  }
+  else {
+    updates.push_back(MissingData(prefix, seq1, seq2));
+  }
+}
+
+void
+LogicConsumer::deliverUpdates(const std::vector<MissingData>& updates)
+{
+  if (m_stream != nullptr) {
+    m_stream->notify();
+  }
+  else if (!updates.empty()) {
+    m_onUpdate(updates);
+  }
+}
+
+UpdateStream&
+LogicConsumer::setUpdateStream(std::size_t capacity)
+{
+  m_stream.reset(new UpdateStream(capacity));
+  m_stream->setOnDrained(bind(&LogicConsumer::onStreamDrained, this));
+  // partitions paused for a stream this one replaces
+  onStreamDrained();
+  return *m_stream;
+}
+
+void
+LogicConsumer::onStreamDrained()
+{
+  for (auto& partition : m_partitions) {
+    if (partition.second.isSyncPaused) {
+      partition.second.isSyncPaused = false;
+      sendSyncInterest(partition.first);
+    }
+  }
+}
+
+bloom_filter
+LogicConsumer::makeBF() const
+{
+  bloom_parameters opt;
+  opt.false_positive_probability = m_false_positive;
+  opt.projected_element_count = m_count;
+  opt.compute_optimal_parameters();
+  return bloom_filter(opt);
+}
+
+ndn::Name
+LogicConsumer::getOwner(const std::string& prefix) const
+{
+  if (m_ring.empty()) {
+    return m_syncPrefix;
+  }
+  return ndn::Name(m_ring.getPartition(prefix));
+}
+
+ConsumerPartition*
+LogicConsumer::findPartition(const ndn::Name& partition)
+{
+  auto it = m_partitions.find(partition);
+  return it == m_partitions.end() ? nullptr : &it->second;
+}
+
+void
+LogicConsumer::setPartitions(const PartitionRing& ring)
+{
+  m_ring = ring;
+  std::vector <ndn::Name> names;
+  if (m_ring.empty()) {
+    names.push_back(m_syncPrefix);
+  }
+  for (const auto& partition : m_ring.getPartitions()) {
+    names.push_back(ndn::Name(partition));
+  }
+
+  // partitions that stay keep their IBLT, those that left are dropped
+  std::map <ndn::Name, ConsumerPartition> partitions;
+  std::vector <ndn::Name> joined;
+  for (const auto& name : names) {
+    auto it = m_partitions.find(name);
+    if (it != m_partitions.end()) {
+      partitions[name] = std::move(it->second);
+    }
+    else {
+      partitions[name].bf = makeBF();
+      joined.push_back(name);
+    }
+  }
+  m_partitions.swap(partitions);
+
+  // subscriptions follow their prefixes
+  for (auto& partition : m_partitions) {
+    partition.second.bf.clear();
+  }
+  for (const auto& s : m_sl) {
+    m_partitions[getOwner(s)].bf.insert(s);
+  }
+  m_isStateDirty = true;
+
+  if (m_helloSent) {
+    for (const auto& name : joined) {
+      sendHelloInterest(name);
+    }
+  }
 }
 
 void
 LogicConsumer::onData(const ndn::Interest& interest, const ndn::Data& data)
 {
-  // on data
+  auto it = m_fetchTimes.find(interest.getName());
+  if (it != m_fetchTimes.end()) {
+    m_metrics.dataFetchRtt.record(microsecondsSince(it->second));
+    m_fetchTimes.erase(it);
+  }
 }
 
 void
@@ -203,4 +761,216 @@ LogicConsumer::onDataTimeout(const ndn::Interest interest)
                          bind(&LogicConsumer::onDataTimeout, this, _1));
 }
 
-}
\ No newline at end of file
+bool
+LogicConsumer::setStateFile(const std::string& path, ndn::time::milliseconds savePeriod)
+{
+  m_stateFile = path;
+  m_savePeriod = savePeriod;
+  bool isLoaded = loadState();
+  // one timer, whatever file and period came before
+  m_scheduler.cancelEvent(m_saveEvent);
+  scheduleStateSave();
+  return isLoaded;
+}
+
+void
+LogicConsumer::scheduleStateSave()
+{
+  m_saveEvent = m_scheduler.scheduleEvent(m_savePeriod, [this] {
+      if (m_isStateDirty)
+        saveState();
+      scheduleStateSave();
+    });
+}
+
+bool
+LogicConsumer::saveState()
+{
+  if (m_stateFile.empty() || !m_helloSent) {
+    return false;
+  }
+
+  std::string out(STATE_MAGIC, sizeof(STATE_MAGIC));
+  bool isValid = true;
+  putNumber<uint32_t>(out, m_count);
+  putNumber<uint32_t>(out, static_cast<uint32_t>(m_false_positive*1000));
+
+  // partitions that joined since the hello have nothing to save yet
+  std::size_t nPartitions = 0;
+  for (const auto& p : m_partitions) {
+    nPartitions += p.second.helloSent;
+  }
+  putNumber<uint32_t>(out, nPartitions);
+  for (const auto& p : m_partitions) {
+    const ConsumerPartition& partition = p.second;
+    if (!partition.helloSent)
+      continue;
+
+    std::string uri = p.first.toUri();
+    isValid = isValid && putBytes<uint16_t>(out, uri.data(), uri.size());
+    putNumber<uint8_t>(out, partition.hasHelloVersion ? STATE_HAS_HELLO_VERSION : 0);
+    putNumber<uint64_t>(out, partition.helloEpoch);
+    putNumber<uint64_t>(out, partition.helloVersion);
+    const ndn::name::Component& table = partition.iblt.get(1);
+    isValid = isValid && putBytes<uint32_t>(out, table.value(), table.value_size());
+  }
+
+  std::set <std::string> ns(m_ns.begin(), m_ns.end());
+  putNumber<uint32_t>(out, m_prefixes.size());
+  for (const auto& p : m_prefixes) {
+    isValid = isValid && putBytes<uint16_t>(out, p.first.data(), p.first.size());
+    putNumber<uint32_t>(out, p.second);
+    putNumber<uint8_t>(out, ns.count(p.first));
+  }
+
+  putNumber<uint32_t>(out, m_sl.size());
+  for (const auto& s : m_sl) {
+    isValid = isValid && putBytes<uint16_t>(out, s.data(), s.size());
+  }
+  if (!isValid) {
+    return false;
+  }
+  putNumber<uint32_t>(out, MurmurHash3(0, reinterpret_cast<const uint8_t*>(out.data()), out.size()));
+
+  // readers see the old file or the new one, never a torn write
+  std::string tmpFile = m_stateFile + ".tmp";
+  int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const char* data = out.data();
+  std::size_t remaining = out.size();
+  while (remaining > 0) {
+    ssize_t n = ::write(fd, data, remaining);
+    if (n <= 0) {
+      ::close(fd);
+      ::unlink(tmpFile.c_str());
+      return false;
+    }
+    data += n;
+    remaining -= n;
+  }
+  if (::fsync(fd) != 0 || ::close(fd) != 0 ||
+      std::rename(tmpFile.c_str(), m_stateFile.c_str()) != 0) {
+    ::unlink(tmpFile.c_str());
+    return false;
+  }
+
+  // the rename itself only survives a crash once the directory is synced
+  std::size_t slash = m_stateFile.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : m_stateFile.substr(0, slash + 1);
+  int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dirFd < 0) {
+    return false;
+  }
+  bool isSynced = ::fsync(dirFd) == 0;
+  ::close(dirFd);
+  if (!isSynced) {
+    return false;
+  }
+
+  m_isStateDirty = false;
+  return true;
+}
+
+bool
+LogicConsumer::loadState()
+{
+  int fd = ::open(m_stateFile.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(STATE_MAGIC) + 4)) {
+    ::close(fd);
+    return false;
+  }
+  std::size_t size = st.st_size;
+  void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  const uint8_t* data = static_cast<const uint8_t*>(mapped);
+
+  // parsed into temporaries first, a bad file leaves the consumer as is
+  bool isValid = std::memcmp(data, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0 &&
+                 iblt::fromBytes<uint32_t>(data + size - 4) == MurmurHash3(0, data, size - 4);
+
+  StateReader reader(data + sizeof(STATE_MAGIC), size - sizeof(STATE_MAGIC) - 4);
+  uint32_t count = 0;
+  uint32_t fp = 0;
+  uint32_t nPartitions = 0;
+  std::map <ndn::Name, ConsumerPartition> partitions;
+  uint32_t nPrefixes = 0;
+  std::map <std::string, uint32_t> prefixes;
+  std::vector <std::string> ns;
+  std::set <std::string> sl;
+
+  isValid = isValid &&
+            reader.getNumber(count) && count == m_count &&
+            reader.getNumber(fp) && fp == static_cast<uint32_t>(m_false_positive*1000) &&
+            reader.getNumber(nPartitions);
+  for (uint32_t i = 0; isValid && i < nPartitions; i++) {
+    std::string uri;
+    uint8_t flags;
+    uint64_t helloEpoch;
+    uint64_t helloVersion;
+    const uint8_t* table;
+    std::size_t tableSize;
+    isValid = reader.getString<uint16_t>(uri) && reader.getNumber(flags) &&
+              reader.getNumber(helloEpoch) && reader.getNumber(helloVersion) &&
+              reader.getBytes<uint32_t>(table, tableSize);
+    // partitions no longer in the ring start over with a hello
+    if (!isValid || m_partitions.find(ndn::Name(uri)) == m_partitions.end())
+      continue;
+
+    ConsumerPartition& partition = partitions[ndn::Name(uri)];
+    partition.hasHelloVersion = (flags & STATE_HAS_HELLO_VERSION) != 0;
+    partition.helloEpoch = helloEpoch;
+    partition.helloVersion = helloVersion;
+    ndn::Name ibltName;
+    ibltName.appendNumber(tableSize);
+    ibltName.append(table, tableSize);
+    setIBLT(partition, ibltName);
+    partition.helloSent = true;
+  }
+  isValid = isValid && reader.getNumber(nPrefixes);
+  for (uint32_t i = 0; isValid && i < nPrefixes; i++) {
+    std::string prefix;
+    uint32_t seq;
+    uint8_t inNs;
+    isValid = reader.getString<uint16_t>(prefix) && reader.getNumber(seq) && reader.getNumber(inNs);
+    prefixes[prefix] = seq;
+    if (inNs)
+      ns.push_back(prefix);
+  }
+  uint32_t nSubscriptions = 0;
+  isValid = isValid && reader.getNumber(nSubscriptions);
+  for (uint32_t i = 0; isValid && i < nSubscriptions; i++) {
+    std::string s;
+    isValid = reader.getString<uint16_t>(s);
+    sl.insert(s);
+  }
+
+  ::munmap(mapped, size);
+  if (!isValid) {
+    return false;
+  }
+
+  m_prefixes.swap(prefixes);
+  m_ns.swap(ns);
+  for (auto& p : partitions) {
+    ConsumerPartition& partition = m_partitions[p.first];
+    p.second.bf = std::move(partition.bf);
+    partition = std::move(p.second);
+  }
+  for (const auto& s : sl) {
+    addSL(s);
+  }
+  m_helloSent = true;
+  m_isStateDirty = false;
+  return true;
+}
+
+}
@@ -5,14 +5,22 @@
 #include <map>
 #include <vector>
 #include <functional>
+#include <chrono>
+#include <memory>
 
 #include "bloom_filter.hpp"
+#include "metrics.hpp"
+#include "partition_ring.hpp"
+#include "update_stream.hpp"
 
 #include <ndn-cxx/common.hpp>
 #include <ndn-cxx/face.hpp>
+#include <ndn-cxx/util/scheduler.hpp>
 
 namespace psync{
 
+class IBLTTree;
+
 struct MissingData
 {
   MissingData(std::string prefix, uint32_t seq1, uint32_t seq2)
@@ -27,7 +35,64 @@ struct MissingData
   uint32_t seq2;
 };
 
-typedef std::function<void(const std::vector<MissingData>)> UpdateCallback;
+struct ConsumerMetrics : public Metrics
+{
+  ConsumerMetrics();
+
+  Counter& helloSent;
+  Counter& helloDeltas;
+  Counter& syncSent;
+  Counter& syncTimeouts;
+  Counter& nacks;
+  Counter& partialReplies;
+  Counter& treeDescents;   // tree interests below the root
+  Counter& updates;        // from sync and tree replies, not hellos
+  Counter& syncPauses;     // sync interests held back for the update stream
+  Histogram& syncRtt;      // microseconds from sync interest to reply
+  Histogram& dataFetchRtt; // microseconds from fetchData to the Data
+};
+
+/**
+ * Sync state with one repo partition. A consumer that is not partitioned
+ * has one, for the sync prefix it was made with.
+ */
+struct ConsumerPartition
+{
+  ConsumerPartition()
+  : ibltDigest(0)
+  , isIBLTKnown(false)
+  , digestMiss(false)
+  , helloSent(false)
+  , hasHelloVersion(false)
+  , helloEpoch(0)
+  , helloVersion(0)
+  , treeRound(0)
+  , nTreeRequests(0)
+  , isSyncPaused(false)
+  {
+  }
+
+  ndn::Name iblt;
+  uint64_t ibltDigest;
+  bool isIBLTKnown; // made with the IBLT parameters and hash of this build
+  bool digestMiss; // repo no longer knows ibltDigest, send the IBLT
+  bool helloSent;
+  // name table version of the repo as of the last hello, so a re-hello
+  // only fetches what changed since; unset with repos that send none
+  bool hasHelloVersion;
+  uint64_t helloEpoch;
+  uint64_t helloVersion;
+  bloom_filter bf; // subscriptions to the prefixes this partition owns
+  std::chrono::steady_clock::time_point syncSentTime;
+  // with tree sync, the leaf tables last received, null until rebuilt
+  // from the prefixes after a hello
+  std::shared_ptr<IBLTTree> tree;
+  uint64_t treeRound; // replies of earlier rounds are dropped
+  std::size_t nTreeRequests; // of this round, the next one starts at 0
+  bool isSyncPaused; // until the update stream drains
+};
+
+typedef std::function<void(const std::vector<MissingData>&)> UpdateCallback;
 typedef std::function<void()> RecieveHelloCallback;
 
 class LogicConsumer
@@ -64,14 +129,81 @@ public:
     return m_prefixes[prefix];
   }
 
+  MetricsSnapshot getMetrics() const {
+    return m_metrics.snapshot();
+  }
+
+  /**
+   * Sync with the repo partitions of ring, named by their sync prefixes,
+   * instead of the one repo. Each gets its own hello, IBLT and sync
+   * interests, whose bloom filter holds only the subscriptions it owns.
+   * Partitions that join get a hello and their prefixes merge in, those
+   * that leave are dropped, and subscriptions follow their prefixes.
+   */
+  void setPartitions(const PartitionRing& ring);
+
+  /**
+   * Sync through the IBLT tree of repos that enableTreeSync() with the
+   * same shape. Each round compares the child digests of the root, then
+   * asks only for the children that differ, down to the leaf tables,
+   * and the next round starts once all answered. Call it before the
+   * hello.
+   */
+  void setTreeSync(std::size_t fanout, std::size_t depth, std::size_t leafEntries);
+
+  /**
+   * Deliver updates through a stream the application pulls from instead
+   * of the UpdateCallback, which is no longer called. Sync interests wait
+   * while the stream holds capacity records, see UpdateStream.
+   */
+  UpdateStream& setUpdateStream(std::size_t capacity);
+
+  /**
+   * Keep the prefixes, subscriptions and last IBLTs in a binary file at
+   * path, rewritten atomically every savePeriod while they change and on
+   * stop(). Returns true if the file held a state saved with the same
+   * bloom filter parameters and it was loaded: the consumer can then
+   * sendSyncInterest() right away and catch up from there, no hello.
+   */
+  bool setStateFile(const std::string& path,
+                    ndn::time::milliseconds savePeriod = ndn::time::milliseconds(1000));
+
+  // write the state file now, false on I/O errors or a name over 64 KiB
+  bool saveState();
+
 private:
-  void onHelloData(const ndn::Interest& interest, const ndn::Data& data);
-  void onSyncData(const ndn::Interest& interest, const ndn::Data& data);
-  void onHelloTimeout(const ndn::Interest& interest);
-  void onSyncTimeout(const ndn::Interest& interest);
+  void sendHelloInterest(const ndn::Name& partition);
+  void sendSyncInterest(const ndn::Name& partition);
+  void onHelloData(const ndn::Name& partition, const ndn::Data& data);
+  void onSyncData(const ndn::Name& partition, const ndn::Data& data);
+  void onHelloTimeout(const ndn::Name& partition);
+  void onSyncTimeout(const ndn::Name& partition);
+  void sendTreeInterest(const ndn::Name& partition, std::size_t level, std::size_t index);
+  void expressTreeInterest(const ndn::Name& partition, uint64_t round,
+                           std::size_t level, std::size_t index);
+  void onTreeData(const ndn::Name& partition, uint64_t round,
+                  std::size_t level, std::size_t index, const ndn::Data& data);
+  void onTreeTimeout(const ndn::Name& partition, uint64_t round,
+                     std::size_t level, std::size_t index);
+  // a request of the round answered, start the next once all are
+  void finishTreeRequest(const ndn::Name& partition);
+  void buildTree(const ndn::Name& partition, ConsumerPartition& state);
   void onData(const ndn::Interest& interest, const ndn::Data& data);
   void onDataTimeout(const ndn::Interest interest);
-  void appendBF(ndn::Name& name);
+  void appendBF(ndn::Name& name, bloom_filter& bf);
+  void setIBLT(ConsumerPartition& partition, const ndn::Name& ibltName);
+  // to the update stream if there is one, else to updates for m_onUpdate
+  void addUpdate(std::vector<MissingData>& updates, const std::string& prefix,
+                 uint32_t seq1, uint32_t seq2);
+  void deliverUpdates(const std::vector<MissingData>& updates);
+  void onStreamDrained();
+  bloom_filter makeBF() const;
+  // sync prefix of the partition owning prefix
+  ndn::Name getOwner(const std::string& prefix) const;
+  // null once the partition left
+  ConsumerPartition* findPartition(const ndn::Name& partition);
+  bool loadState();
+  void scheduleStateSave();
 
 private:
   ndn::Name m_syncPrefix;
@@ -81,12 +213,25 @@ private:
   unsigned int m_count;
   double m_false_positive;
   bool m_suball;
-  ndn::Name m_iblt;
   std::map <std::string, uint32_t> m_prefixes;
-  bool m_helloSent;
+  bool m_helloSent; // every partition answered its first hello
   std::set <std::string> m_sl;
   std::vector <std::string> m_ns;
-  bloom_filter m_bf;
+  PartitionRing m_ring; // empty unless partitioned
+  std::map <ndn::Name, ConsumerPartition> m_partitions;
+  std::size_t m_treeFanout; // 0 unless tree sync is used
+  std::size_t m_treeDepth;
+  std::size_t m_treeLeafEntries;
+  std::unique_ptr<UpdateStream> m_stream; // null unless setUpdateStream()
+
+  ConsumerMetrics m_metrics;
+  std::map <ndn::Name, std::chrono::steady_clock::time_point> m_fetchTimes;
+
+  ndn::Scheduler m_scheduler;
+  std::string m_stateFile; // empty unless persisted
+  ndn::time::milliseconds m_savePeriod;
+  ndn::EventId m_saveEvent;
+  bool m_isStateDirty;
 };
 
 }
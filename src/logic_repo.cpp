@@ -1,20 +1,99 @@
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <limits>
+#include <random>
+#include <sstream>
+#include <thread>
 
 #include "logic_repo.hpp"
 #include "murmurhash3.hpp"
-#include "parse.hpp"
+#include "trace.hpp"
 
 #include <ndn-cxx/common.hpp>
 
-#include <boost/date_time/posix_time/posix_time.hpp>
-
-namespace pt = boost::posix_time;
 
 namespace psync {
 
-static const size_t N_HASHCHECK = 11;
+static const size_t DEFAULT_HISTORY_SIZE = 1024;
+// queued publications applied per face thread turn, the rest wait for the next
+static const size_t MAX_PUBLISH_DRAIN = 1024;
+// distinct sync interests remembered per state version
+static const size_t SYNC_CACHE_SIZE = 256;
+// replica fetches in flight, the rest wait in the queue
+static const size_t MAX_REPLICA_FETCHES = 64;
+// newest publications of a prefix copied when a replica is further behind
+static const uint32_t MAX_REPLICA_BACKFILL = 64;
+// publications queued or in flight, newer ones are not copied past that
+static const size_t MAX_REPLICA_FETCH_NAMES = 4096;
+// failed fetches of a publication per peer, then the next peer is asked,
+// and once every peer failed it is given up on
+static const int MAX_REPLICA_FETCH_RETRIES = 3;
+static const ndn::time::milliseconds REPLICA_RETRY_DELAY(1000);
+
+RepoMetrics::RepoMetrics()
+: publishes(counter("publishes"))
+, publishDrains(counter("publish_drains"))
+, helloInterests(counter("hello_interests"))
+, helloDeltas(counter("hello_deltas"))
+, syncInterests(counter("sync_interests"))
+, digestInterests(counter("digest_interests"))
+, digestMisses(counter("digest_misses"))
+, peelComplete(counter("peel_complete"))
+, peelPartial(counter("peel_partial"))
+, peelStalled(counter("peel_stalled"))
+, syncReplies(counter("sync_replies"))
+, syncCacheHits(counter("sync_cache_hits"))
+, nacks(counter("nacks"))
+, replicaUpdates(counter("replica_updates"))
+, replicaFetches(counter("replica_fetches"))
+, replicaFetchMisses(counter("replica_fetch_misses"))
+, handoffDrops(counter("handoff_drops"))
+, foreignDrops(counter("foreign_drops"))
+, treeInterests(counter("tree_interests"))
+, leafListings(counter("leaf_listings"))
+, syncProcessingTime(histogram("sync_processing_us"))
+, pendingEntries(histogram("pending_entries"))
+, coalescedUpdates(histogram("coalesced_updates"))
+, replySize(histogram("reply_bytes"))
+{
+}
+
+// "prefix seq" without going through a heap allocated std::string
+template<typename String>
+static void
+appendUpdate(ArenaString& content, const String& prefix, uint32_t seq)
+{
+  char seqStr[16];
+  int length = snprintf(seqStr, sizeof(seqStr), "%" PRIu32, seq);
+  content.append(prefix.data(), prefix.size()).append(" ").append(seqStr, length);
+}
+
+std::size_t
+PendingStateHash::operator()(const bloom_filter& bf) const
+{
+  const bloom_filter::table_type& table = bf.bit_table();
+  return MurmurHash3(bf.getBitSize(), table.data(), table.size());
+}
+
+// " seq\n" after a name written in place
+static void
+appendSeqLine(ArenaString& content, uint32_t seq)
+{
+  char seqStr[16];
+  int length = snprintf(seqStr, sizeof(seqStr), " %" PRIu32 "\n", seq);
+  content.append(seqStr, length);
+}
+
+// per worker thread, for tasks of any LogicRepo
+static Arena&
+workerArena()
+{
+  static thread_local Arena arena;
+  return arena;
+}
 
 LogicRepo::LogicRepo(size_t expectedNumEntries, 
                      ndn::Face& face,
@@ -24,11 +103,27 @@ LogicRepo::LogicRepo(size_t expectedNumEntries,
 : m_iblt(expectedNumEntries)
 , m_expectedNumEntries(expectedNumEntries)
 , m_threshold(expectedNumEntries/2)
+, m_namesEpoch((static_cast<uint64_t>(std::random_device()()) << 32) | std::random_device()())
+, m_namesVersion(0)
+, m_firstChange(NameTrie::INVALID_ID)
+, m_lastChange(NameTrie::INVALID_ID)
+, m_deltaHorizon(0)
+, m_coalescingWindow(0)
+, m_coalescingMaxDelay(0)
+, m_isPassScheduled(false)
+, m_syncCacheVersion(0)
+, m_historyStart(0)
+, m_historySize(DEFAULT_HISTORY_SIZE)
+, m_version(0)
 , m_face(face)
 , m_syncPrefix(prefix)
 , m_scheduler(m_face.getIoService())
 , m_helloReplyFreshness(helloReplyFreshness)
 , m_syncReplyFreshness(syncReplyFreshness)
+, m_isDrainScheduled(false)
+, m_alive(std::make_shared<bool>(true))
+, m_nReplicaFetching(0)
+, m_handoffCount(0)
 {
   ndn::Name helloName = m_syncPrefix;
   helloName.append("hello");
@@ -41,19 +136,63 @@ LogicRepo::LogicRepo(size_t expectedNumEntries,
   m_face.setInterestFilter(syncName,
                              bind(&LogicRepo::onSyncInterest, this, _1, _2),
                              bind(&LogicRepo::onSyncRegisterFailed, this, _1, _2));
+
+  ndn::Name digestName = m_syncPrefix;
+  digestName.append("digest");
+  m_face.setInterestFilter(digestName,
+                             bind(&LogicRepo::onDigestInterest, this, _1, _2),
+                             bind(&LogicRepo::onSyncRegisterFailed, this, _1, _2));
+
+  ndn::Name dataName = m_syncPrefix;
+  dataName.append("data");
+  m_face.setInterestFilter(dataName,
+                             bind(&LogicRepo::onReplicaDataInterest, this, _1, _2),
+                             bind(&LogicRepo::onSyncRegisterFailed, this, _1, _2));
 }
 
 LogicRepo::~LogicRepo()
 {
+  // running tasks finish, replies they post are dropped
+  m_publishSigner.reset();
+  m_workers.reset();
+  m_alive.reset();
   m_face.shutdown();
 };
 
+void
+LogicRepo::setWorkerThreads(std::size_t nThreads)
+{
+  // publications in flight have taken their sequence numbers, they are
+  // stored and announced before their signer goes away
+  if (m_publishSigner != nullptr) {
+    m_publishSigner->drain();
+  }
+  m_publishSigner.reset();
+  m_workers.reset();
+  if (nThreads > 0) {
+    m_workers.reset(new ThreadPool(nThreads));
+    m_publishSigner.reset(new BatchSigner(*m_workers, m_face.getIoService(), m_signingPolicy,
+                                          SigningPolicy::PUBLISHED_DATA));
+  }
+}
+
 void
 LogicRepo::addSyncNode(std::string prefix)
 {
-  if (m_prefixes.find(prefix) == m_prefixes.end())
-    m_prefixes[prefix] = 0; 
+  if (!isOwned(prefix)) {
+    m_metrics.foreignDrops.increment();
+    return;
+  }
+  if (m_names.find(prefix) == NameTrie::INVALID_ID) {
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    addName(prefix);
+  }
 
+  ndn::Name name(prefix);
+  for (const auto& filter : m_loadFilters) {
+    if (filter.isPrefixOf(name))
+      return;
+  }
   m_face.setInterestFilter(prefix,
                            bind(&LogicRepo::onInterest, this, _1, _2),
                            [] (const ndn::Name& prefix, const std::string& msg) {});
@@ -62,22 +201,244 @@ LogicRepo::addSyncNode(std::string prefix)
 void
 LogicRepo::removeSyncNode(std::string prefix)
 {
-  if (m_prefixes.find(prefix) != m_prefixes.end()) {
-    uint32_t seqNo = m_prefixes[prefix];
-    m_prefixes.erase(prefix);
-    std::string prefixWithSeq = prefix + "/" + std::to_string(seqNo);
-    uint32_t hash = m_prefix2hash[prefixWithSeq];
-    m_prefix2hash.erase(prefixWithSeq);
-    m_hash2prefix.erase(hash);
-    m_iblt.erase(hash);
+  {
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    NameTrie::Id id = m_names.find(prefix);
+    if (id == NameTrie::INVALID_ID) {
+      return;
+    }
+
+    ProducerState producer = m_producers[id];
+    unlinkChange(id);
+    m_names.erase(id);
+    m_producers[id] = ProducerState();
+
+    RemovedName removed;
+    removed.version = ++m_namesVersion;
+    removed.prefix = prefix;
+    m_removedNames.push_back(removed);
+    setHistorySize(m_historySize);
+    if (producer.seq == 0) {
+      return;
+    }
+    m_hash2id.erase(producer.hash);
+    m_iblt.erase(producer.hash);
+    eraseTreeKey(producer.hash);
+    ++m_version;
+    recordHistory(true, producer.hash, false, 0);
+  }
+
+  // a leaf digest changed under the parked tree interests
+  if (m_tree != nullptr) {
+    satisfyTreeEntries();
+  }
+}
+
+void
+LogicRepo::insertTreeKey(IBLT::Key key)
+{
+  if (m_tree == nullptr) {
+    return;
+  }
+  m_tree->insert(key);
+  m_leafKeys[m_tree->getLeaf(key)].push_back(key);
+}
+
+void
+LogicRepo::eraseTreeKey(IBLT::Key key)
+{
+  if (m_tree == nullptr) {
+    return;
+  }
+  m_tree->erase(key);
+  std::vector<IBLT::Key>& leafKeys = m_leafKeys[m_tree->getLeaf(key)];
+  auto it = std::find(leafKeys.begin(), leafKeys.end(), key);
+  if (it != leafKeys.end()) {
+    *it = leafKeys.back();
+    leafKeys.pop_back();
+  }
+}
+
+NameTrie::Id
+LogicRepo::addName(const std::string& prefix)
+{
+  NameTrie::Id id = m_names.insert(prefix).first;
+  if (id >= m_producers.size()) {
+    m_producers.resize(m_names.idBound());
+  }
+  m_producers[id] = ProducerState();
+  markChanged(id);
+  trace::defineName(prefix);
+  return id;
+}
+
+void
+LogicRepo::markChanged(NameTrie::Id id)
+{
+  unlinkChange(id);
+
+  ProducerState& producer = m_producers[id];
+  producer.changedAt = ++m_namesVersion;
+  producer.prevChange = m_lastChange;
+  if (m_lastChange != NameTrie::INVALID_ID)
+    m_producers[m_lastChange].nextChange = id;
+  else
+    m_firstChange = id;
+  m_lastChange = id;
+}
+
+void
+LogicRepo::unlinkChange(NameTrie::Id id)
+{
+  ProducerState& producer = m_producers[id];
+  if (producer.changedAt == 0) {
+    return;
+  }
+
+  if (producer.prevChange != NameTrie::INVALID_ID)
+    m_producers[producer.prevChange].nextChange = producer.nextChange;
+  else
+    m_firstChange = producer.nextChange;
+  if (producer.nextChange != NameTrie::INVALID_ID)
+    m_producers[producer.nextChange].prevChange = producer.prevChange;
+  else
+    m_lastChange = producer.prevChange;
+
+  producer.changedAt = 0;
+  producer.prevChange = NameTrie::INVALID_ID;
+  producer.nextChange = NameTrie::INVALID_ID;
+}
+
+void
+LogicRepo::setCoalescingWindow(ndn::time::microseconds window, ndn::time::microseconds maxDelay)
+{
+  m_coalescingWindow = window;
+  m_coalescingMaxDelay = std::max(window, maxDelay);
+  satisfyPendingEntries();
+}
+
+void
+LogicRepo::setHistorySize(std::size_t historySize)
+{
+  m_historySize = historySize;
+  while (m_history.size() > m_historySize) {
+    auto it = m_digest2history.find(m_history.front().digest);
+    if (it != m_digest2history.end() && it->second == m_historyStart)
+      m_digest2history.erase(it);
+    m_history.pop_front();
+    ++m_historyStart;
+  }
+
+  while (m_removedNames.size() > m_historySize) {
+    m_deltaHorizon = m_removedNames.front().version;
+    m_removedNames.pop_front();
   }
 }
 
+MetricsSnapshot
+LogicRepo::getMetrics() const
+{
+  MetricsSnapshot snapshot = m_metrics.snapshot();
+  snapshot.counters["iblt_entries"] = m_hash2id.size();
+  snapshot.counters["producer_names"] = m_names.size();
+  snapshot.counters["name_store_bytes"] = m_names.memoryUsage() +
+                                          m_producers.capacity() * sizeof(ProducerState);
+  snapshot.counters["iblt_cells"] = m_iblt.getNumEntry();
+  snapshot.counters["pending_entries"] = m_pendingEntries.size();
+  snapshot.counters["pending_filters"] = m_bfPool.size();
+  snapshot.counters["pending_iblts"] = m_ibltPool.size();
+  snapshot.counters["pending_tree_entries"] = m_pendingTreeEntries.size();
+  snapshot.counters["replica_fetch_names"] = m_replicaFetchNames.size();
+  return snapshot;
+}
+
+void
+LogicRepo::enableStatusDataset()
+{
+  ndn::Name statusName = m_syncPrefix;
+  statusName.append("status");
+  m_face.setInterestFilter(statusName,
+                           bind(&LogicRepo::onStatusInterest, this, _1, _2),
+                           bind(&LogicRepo::onSyncRegisterFailed, this, _1, _2));
+}
+
+void
+LogicRepo::onStatusInterest(const ndn::Name& prefix, const ndn::Interest& interest)
+{
+  std::string content = getMetrics().toString();
+
+  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>(interest.getName());
+  data->setFreshnessPeriod(ndn::time::milliseconds(1000));
+  data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+  data->setCachingPolicy(ndn::lp::LocalControlHeaderFacade::CachingPolicy::NO_CACHE);
+  m_signingPolicy.sign(*data, SigningPolicy::HELLO_REPLY, m_keyChain);
+  m_face.put(*data);
+}
+
 void
 LogicRepo::publishData(const ndn::Block& content, const ndn::time::milliseconds& freshness, 
                       std::string prefix)
 {
-  if (m_prefixes.find(prefix) == m_prefixes.end()) {
+  addPublication(content, freshness, prefix);
+  schedulePendingPass();
+}
+
+void
+LogicRepo::enqueuePublish(const ndn::Block& content, const ndn::time::milliseconds& freshness,
+                          const std::string& prefix)
+{
+  PublishRequest request;
+  request.prefix = prefix;
+  request.content = content;
+  request.freshness = freshness;
+  m_publishQueue.push(std::move(request));
+
+  // only after the push returned, the drain might miss it otherwise
+  if (m_isDrainScheduled.exchange(true)) {
+    return;
+  }
+  std::weak_ptr<bool> alive = m_alive;
+  m_face.getIoService().post([this, alive] {
+      if (!alive.expired())
+        drainPublishQueue();
+    });
+}
+
+void
+LogicRepo::drainPublishQueue()
+{
+  // requests pushed from here on schedule another drain
+  m_isDrainScheduled = false;
+  m_metrics.publishDrains.increment();
+
+  PublishRequest request;
+  std::size_t nDrained = 0;
+  while (nDrained < MAX_PUBLISH_DRAIN && m_publishQueue.pop(request)) {
+    addPublication(request.content, request.freshness, request.prefix);
+    ++nDrained;
+  }
+  schedulePendingPass();
+
+  if (nDrained == MAX_PUBLISH_DRAIN && !m_isDrainScheduled.exchange(true)) {
+    std::weak_ptr<bool> alive = m_alive;
+    m_face.getIoService().post([this, alive] {
+        if (!alive.expired())
+          drainPublishQueue();
+      });
+  }
+}
+
+void
+LogicRepo::addPublication(const ndn::Block& content, const ndn::time::milliseconds& freshness,
+                          const std::string& prefix)
+{
+  NameTrie::Id id = m_names.find(prefix);
+  if (id == NameTrie::INVALID_ID) {
+    return;
+  }
+  if (!isOwned(prefix)) {
+    // the producer has not moved to the new owner yet
+    m_metrics.foreignDrops.increment();
     return;
   }
 
@@ -85,17 +446,47 @@ LogicRepo::publishData(const ndn::Block& content, const ndn::time::milliseconds&
   data->setContent(content);
   data->setFreshnessPeriod(freshness);
 
-  uint32_t newSeq = m_prefixes[prefix] + 1;
+  // publications still being signed have taken their numbers already
+  ProducerState& producer = m_producers[id];
+  producer.publishedSeq = std::max(producer.publishedSeq, producer.seq) + 1;
+  uint32_t newSeq = producer.publishedSeq;
+
   ndn::Name dataName;
   dataName.append(ndn::Name(prefix).appendNumber(newSeq));
   data->setName(dataName);
-  m_keyChain.sign(*data);
-  m_ims.insert(*data);
 
-  pt::ptime current_date_microseconds = pt::microsec_clock::local_time();
-  std::cout << "Publish: "<< prefix << "/" << newSeq << " " << current_date_microseconds << std::endl;
+  if (m_publishSigner != nullptr) {
+    m_publishSigner->add(data, [this, prefix, newSeq] (const ndn::shared_ptr<ndn::Data>& data) {
+        finishPublish(*data, prefix, newSeq);
+        schedulePendingPass();
+      });
+    return;
+  }
+
+  m_signingPolicy.sign(*data, SigningPolicy::PUBLISHED_DATA, m_keyChain);
+  finishPublish(*data, prefix, newSeq);
+}
+
+void
+LogicRepo::finishPublish(const ndn::Data& data, const std::string& prefix, uint32_t seq)
+{
+  // removed while it was being signed
+  if (m_names.find(prefix) == NameTrie::INVALID_ID) {
+    return;
+  }
+
+  m_ims.insert(data);
+  m_metrics.publishes.increment();
 
-  this->updateSeq(prefix, m_prefixes[prefix]+1);
+  PSYNC_TRACE(trace::LEVEL_INFO, trace::EVENT_PUBLISH, trace::nameId(prefix), seq);
+
+  applySeq(prefix, seq);
+}
+
+void
+LogicRepo::setSigningPolicy(const SigningPolicy& policy)
+{
+  m_signingPolicy = policy;
 }
 
 void
@@ -110,234 +501,1441 @@ LogicRepo::onInterest(const ndn::Name& prefix, const ndn::Interest& interest)
 void
 LogicRepo::onHelloInterest(const ndn::Name& prefix, const ndn::Interest& interest)
 {
-  // generate hello data with NO_CACHE
-  std::string content;
-  for (auto p : m_prefixes) {
-    content += p.first + " " + std::to_string(p.second) + "\n";
+  ArenaScope scope(m_arena);
+  const ndn::Name& interestName = interest.getName();
+
+  // <hello>/<epoch>/<version> asks for the changes since that version
+  ArenaString content(&m_arena);
+  bool isDelta = false;
+  if (interestName.size() == prefix.size() + 2 &&
+      interestName.get(prefix.size()).toNumber() == m_namesEpoch) {
+    isDelta = appendHelloDelta(content, interestName.get(prefix.size() + 1).toNumber());
+  }
+
+  // generate hello data with NO_CACHE, names come out of the trie in order
+  if (!isDelta) {
+    content.clear();
+    m_names.forEach([&] (NameTrie::Id id, const std::string& name) {
+        appendUpdate(content, name, m_producers[id].seq);
+        content.append("\n");
+      });
+  }
+  else {
+    m_metrics.helloDeltas.increment();
   }
 
+  // the version goes before the IBLT, which consumers take from the end
   ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>();
-  ndn::Name helloInterestName = prefix;
-  appendIBLT(helloInterestName);
+  ndn::Name helloInterestName = interestName;
+  helloInterestName.appendNumber(m_namesEpoch);
+  helloInterestName.appendNumber(m_namesVersion);
+  appendIBLT(helloInterestName, m_iblt, m_arena);
   data->setName(helloInterestName);
   data->setFreshnessPeriod(m_helloReplyFreshness);
   data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
   data->setCachingPolicy(ndn::lp::LocalControlHeaderFacade::CachingPolicy::NO_CACHE);
-  m_keyChain.sign(*data);
+  m_signingPolicy.sign(*data, SigningPolicy::HELLO_REPLY, m_keyChain);
   m_face.put(*data);
+
+  m_metrics.helloInterests.increment();
+  m_metrics.replySize.record(data->wireEncode().size());
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_HELLO, 0, data->wireEncode().size());
 }
 
-void
-LogicRepo::onSyncInterest(const ndn::Name& prefix, const ndn::Interest& interest)
+bool
+LogicRepo::appendHelloDelta(ArenaString& content, uint64_t version) const
 {
-  // parser BF and IBLT Not finished yet
-  ndn::Name interestName = interest.getName();
-  std::size_t bfSize = interestName.get(interestName.size()-4).toNumber();
-  ndn::name::Component bfName = interestName.get(interestName.size()-3);
-  std::size_t ibltSize = interestName.get(interestName.size()-2).toNumber();
-  ndn::name::Component ibltName = interestName.get(interestName.size()-1);
+  // from another run of this epoch, or removals since then are forgotten
+  if (version > m_namesVersion || version < m_deltaHorizon) {
+    return false;
+  }
+
+  content.append("DELTA 0\n");
+  // removed prefixes are marked with a leading "-", and come first in
+  // case they were added again since
+  for (auto it = m_removedNames.rbegin(); it != m_removedNames.rend() && it->version > version; ++it) {
+    content.append("-");
+    appendUpdate(content, it->prefix, 0);
+    content.append("\n");
+  }
 
-  bloom_parameters opt;
-  opt.projected_element_count = interestName.get(interestName.size()-6).toNumber();
-  opt.false_positive_probability = interestName.get(interestName.size()-5).toNumber()/1000.;
-  opt.compute_optimal_parameters();
-  bloom_filter bf(opt);
-  bf.setTable(std::vector <uint8_t>(bfName.begin()+this->getSize(bfSize), bfName.end()));
+  std::size_t nChanges = 0;
+  for (NameTrie::Id id = m_lastChange;
+       id != NameTrie::INVALID_ID && m_producers[id].changedAt > version;
+       id = m_producers[id].prevChange) {
+    // more than half the table is cheaper as a full hello
+    if (++nChanges > m_names.size() / 2 + 1) {
+      return false;
+    }
+    m_names.appendName(id, content);
+    appendSeqLine(content, m_producers[id].seq);
+  }
 
-  std::vector <uint8_t> testTable(bfName.begin(), bfName.end());
+  return true;
+}
 
-  std::vector <uint8_t> ibltValues(ibltName.begin()+this->getSize(ibltSize), ibltName.end());
-  std::size_t N = ibltValues.size()/4;
-  std::vector <uint32_t> values(N, 0);
+void
+LogicRepo::onSyncInterest(const ndn::Name& prefix, const ndn::Interest& interest)
+{
+  m_metrics.syncInterests.increment();
 
-  for (int i = 0; i < 4*N; i += 4) {
-    uint32_t t = (ibltValues[i+3] << 24) + (ibltValues[i+2] << 16) + (ibltValues[i+1] << 8) + ibltValues[i];
-    values[i/4] = t;
+  // caught-up consumers with the same subscription send the same name
+  const SyncOutcome* cached = findSyncOutcome(interest.getName());
+  if (cached != nullptr) {
+    m_metrics.syncCacheHits.increment();
+    finishSyncInterest(interest, *cached);
+    return;
   }
 
-  // get the difference
-  IBLT iblt(m_expectedNumEntries, values);
-  IBLT diff = m_iblt - iblt;
-  std::set<uint32_t> positive;
-  std::set<uint32_t> negative;
-
-  if (!diff.listEntries(positive, negative)) {
-      std::cout << "Send Nack back" << std::endl;
-      this->sendNack(interest);
-      return;
+  if (m_workers != nullptr) {
+    dispatchSyncInterest(interest);
+    return;
   }
+  handleSyncInterest(interest);
+}
 
-  //assert((positive.size() == 1 && negative.size() == 1) || (positive.size() == 0 && negative.size() == 0));
+void
+LogicRepo::handleSyncInterest(const ndn::Interest& interest)
+{
+  ScopedTimer timer(m_metrics.syncProcessingTime);
+  ArenaScope scope(m_arena);
 
-  // generate content in Sync reply
-  std::string content;
-  for (auto hash : positive) {
-    std::string prefix = m_hash2prefix[hash];
-    if (bf.contains(prefix)) {
-      // generate data
-      content += prefix + " " + std::to_string(m_prefixes[prefix]) + "\n";
-    }
+  SyncOutcome outcome = processSyncInterest(interest, m_iblt, m_arena, m_keyChain);
+  cacheSyncOutcome(interest.getName(), outcome);
+  finishSyncInterest(interest, outcome);
+}
+
+const SyncOutcome*
+LogicRepo::findSyncOutcome(const ndn::Name& interestName)
+{
+  if (m_syncCacheVersion != m_version) {
+    m_syncCache.clear();
+    m_syncCacheVersion = m_version;
+    return nullptr;
   }
 
-  if (positive.size() + negative.size() >= m_threshold || !content.empty()) {
-    // send back data
-    ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>();
-    ndn::Name syncDataName = interest.getName();
-    appendIBLT(syncDataName);
-    data->setName(syncDataName);
-    data->setFreshnessPeriod(m_syncReplyFreshness);
-    data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
-    m_keyChain.sign(*data);
-    m_face.put(*data);
+  auto it = m_syncCache.find(getSyncInterestDigest(interestName));
+  if (it == m_syncCache.end() || it->second.interestName != interestName) {
+    return nullptr;
+  }
+  return &it->second.outcome;
+}
+
+void
+LogicRepo::cacheSyncOutcome(const ndn::Name& interestName, const SyncOutcome& outcome)
+{
+  if (m_syncCacheVersion != m_version) {
+    m_syncCache.clear();
+    m_syncCacheVersion = m_version;
+  }
+  if (m_syncCache.size() >= SYNC_CACHE_SIZE) {
     return;
   }
-  
-  // add the entry to the pending entry
-  PendingEntryInfo entry(bf, iblt);
-  m_pendingEntries.insert(std::map<ndn::Name, PendingEntryInfo>::value_type(interest.getName(), entry));
-  m_pendingEntries.find(interest.getName())->second.expirationEvent = m_scheduler.scheduleEvent(interest.getInterestLifetime(), 
-                                                [=] () {
-                                                  m_pendingEntries.erase(interest.getName()); 
-                                                  });
 
+  CachedSyncOutcome& cached = m_syncCache[getSyncInterestDigest(interestName)];
+  cached.interestName = interestName;
+  cached.outcome = outcome;
 }
 
-void
-LogicRepo::onSyncRegisterFailed(const ndn::Name& prefix, const std::string& msg)
+uint32_t
+LogicRepo::getSyncInterestDigest(const ndn::Name& interestName)
 {
-  std::cout << ">> Logic::onSyncRegisterFailed" << std::endl;
+  // hash id, count, fp*1000, BF size, BF, IBLT size, IBLT
+  uint32_t digest = 0;
+  for (std::size_t i = interestName.size() - 7; i < interestName.size(); i++) {
+    const ndn::name::Component& component = interestName.get(i);
+    digest = MurmurHash3(digest, component.value(), component.value_size());
+  }
+  return digest;
 }
 
-void
-LogicRepo::appendIBLT(ndn::Name& name)
+SyncOutcome
+LogicRepo::processSyncInterest(const ndn::Interest& interest, const IBLT& state,
+                               Arena& arena, ndn::KeyChain& keyChain) const
 {
-  std::vector <HashTableEntry> hashTable = m_iblt.getHashTable();
-  size_t N = hashTable.size();
-  size_t unitSize = 32*3/8; // hard coding
-  size_t tableSize = unitSize*N;
+  // parser BF and IBLT Not finished yet
+  const ndn::Name& interestName = interest.getName();
+  ndn::name::Component ibltName = interestName.get(interestName.size()-1);
 
-  std::vector <uint8_t> table(tableSize);
+  SyncOutcome outcome;
+  if (!hasValidBF(interestName, interestName.size()-6)) {
+    outcome.reply = makeNack(interestName, keyChain);
+    return outcome;
+  }
+  bloom_filter bf = decodeBF(interestName, interestName.size()-6, arena);
 
-  for (int i = 0; i < N; i++) {
-    // table[i*12],   table[i*12+1], table[i*12+2], table[i*12+3] --> hashTable[i].count
+  // get the difference
+  IBLT iblt(m_expectedNumEntries, &arena);
+  if (!iblt.decode(ibltName.value(), ibltName.value_size())) {
+    // built with another IBLT configuration
+    outcome.reply = makeNack(interestName, keyChain);
+    return outcome;
+  }
+  IBLT diff(state, &arena);
+  diff -= iblt;
+  KeySet positive(&arena);
+  KeySet negative(&arena);
 
-    table[i*12]   = 0xFF & hashTable[i].count;
-    table[i*12+1] = 0xFF & (hashTable[i].count >> 8);
-    table[i*12+2] = 0xFF & (hashTable[i].count >> 16);
-    table[i*12+3] = 0xFF & (hashTable[i].count >> 24);
+  bool isComplete = diff.listEntries(positive, negative);
+  recordPeel(isComplete, positive.size() + negative.size());
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_SYNC_INTEREST, 0, positive.size() + negative.size());
+  if (!isComplete) {
+    if (positive.empty() && negative.empty()) {
+      outcome.reply = makeNack(interestName, keyChain);
+    }
+    else {
+      outcome.reply = makePartial(interestName, iblt, bf, positive, negative, arena, keyChain);
+    }
+    return outcome;
+  }
 
-    // table[i*12+4], table[i*12+5], table[i*12+6], table[i*12+7] --> hashTable[i].keySum
+  return decideSyncReply(interest, bf, iblt, positive, negative, state, arena, keyChain);
+}
 
-    table[i*12+4] = 0xFF & hashTable[i].keySum;
-    table[i*12+5] = 0xFF & (hashTable[i].keySum >> 8);
-    table[i*12+6] = 0xFF & (hashTable[i].keySum >> 16);
-    table[i*12+7] = 0xFF & (hashTable[i].keySum >> 24);
+void
+LogicRepo::dispatchSyncInterest(const ndn::Interest& interest)
+{
+  std::shared_ptr<const RepoSnapshot> snapshot = getSnapshot();
+  std::weak_ptr<bool> alive = m_alive;
 
-    // table[i*12+8], table[i*12+9], table[i*12+10], table[i*12+11] --> hashTable[i].keyCheck
+  m_workers->submit([=] {
+      ScopedTimer timer(m_metrics.syncProcessingTime);
+      Arena& arena = workerArena();
+      ArenaScope scope(arena);
 
-    table[i*12+8] = 0xFF & hashTable[i].keyCheck;
-    table[i*12+9] = 0xFF & (hashTable[i].keyCheck >> 8);
-    table[i*12+10] = 0xFF & (hashTable[i].keyCheck >> 16);
-    table[i*12+11] = 0xFF & (hashTable[i].keyCheck >> 24);
-  }
+      std::shared_ptr<SyncOutcome> outcome =
+        std::make_shared<SyncOutcome>(processSyncInterest(interest, snapshot->iblt,
+                                                          arena, SigningPolicy::threadKeyChain()));
+      m_face.getIoService().post([=] {
+          if (alive.expired())
+            return;
 
-  name.appendNumber(table.size());
-  name.append(table.begin(), table.end());
+          if (outcome->pending != nullptr && snapshot->version != m_version) {
+            // the state moved on while this interest was judged up to date
+            handleSyncInterest(interest);
+            return;
+          }
+          if (snapshot->version == m_version) {
+            cacheSyncOutcome(interest.getName(), *outcome);
+          }
+          finishSyncInterest(interest, *outcome);
+        });
+    });
 }
 
-void
-LogicRepo::sendNack(const ndn::Interest interest)
+std::shared_ptr<const RepoSnapshot>
+LogicRepo::getSnapshot()
 {
-  std::string content = "NACK 0";
-  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>();
-  data->setName(interest.getName());
-  data->setFreshnessPeriod(m_syncReplyFreshness);
-  data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
-  m_keyChain.sign(*data);
-  m_face.put(*data);
+  if (m_snapshot == nullptr || m_snapshot->version != m_version) {
+    std::shared_ptr<RepoSnapshot> snapshot = std::make_shared<RepoSnapshot>();
+    snapshot->version = m_version;
+    snapshot->iblt = m_iblt;
+    m_snapshot = snapshot;
+  }
+  return m_snapshot;
 }
 
-std::size_t
-LogicRepo::getSize(uint64_t varNumber)
+void
+LogicRepo::onDigestInterest(const ndn::Name& prefix, const ndn::Interest& interest)
 {
-  std::size_t ans = 1;
-  if (varNumber < 253) {
-    ans += 1;
+  m_metrics.digestInterests.increment();
+  ScopedTimer timer(m_metrics.syncProcessingTime);
+  ArenaScope scope(m_arena);
+
+  ndn::Name interestName = interest.getName();
+  uint64_t digest = interestName.get(interestName.size()-1).toNumber();
+
+  if (!hasValidBF(interestName, interestName.size()-5)) {
+    m_face.put(*makeNack(interestName, m_keyChain));
+    return;
   }
-  else if (varNumber <= std::numeric_limits<uint16_t>::max()) {
-    ans += 3;
+  bloom_filter bf = decodeBF(interestName, interestName.size()-5, m_arena);
+
+  if (digest != m_iblt.getDigest()) {
+    auto it = m_digest2history.find(digest);
+    if (it == m_digest2history.end()) {
+      // aged out or never seen, the consumer retries with its full IBLT
+      m_metrics.digestMisses.increment();
+      PSYNC_TRACE(trace::LEVEL_INFO, trace::EVENT_DIGEST_MISS, digest, 0);
+      std::string content = "MISS 0";
+      ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>(interestName);
+      data->setFreshnessPeriod(m_syncReplyFreshness);
+      data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+      m_signingPolicy.sign(*data, SigningPolicy::NACK_REPLY, m_keyChain);
+      m_face.put(*data);
+      return;
+    }
   }
-  else if (varNumber <= std::numeric_limits<uint32_t>::max()) {
-    ans += 5;
+
+  // Replay the changes made after the consumer's state: the net count of
+  // each key is exactly what peeling m_iblt - iblt would have produced.
+  std::map <IBLT::Key, int, std::less<IBLT::Key>, ArenaAllocator<std::pair<const IBLT::Key, int> > > net(&m_arena);
+  IBLT iblt(m_iblt, &m_arena);
+  if (digest != m_iblt.getDigest()) {
+    for (std::size_t i = m_digest2history[digest] - m_historyStart + 1; i < m_history.size(); i++) {
+      const HistoryEntry& change = m_history[i];
+      if (change.hasRemoved) {
+        --net[change.removed];
+        iblt.insert(change.removed);
+      }
+      if (change.hasAdded) {
+        ++net[change.added];
+        iblt.erase(change.added);
+      }
+    }
   }
-  else {
-    ans += 9;
+
+  KeySet positive(&m_arena);
+  KeySet negative(&m_arena);
+  for (auto n : net) {
+    if (n.second > 0)
+      positive.insert(n.first);
+    else if (n.second < 0)
+      negative.insert(n.first);
   }
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_SYNC_INTEREST, 1, positive.size() + negative.size());
+
+  finishSyncInterest(interest, decideSyncReply(interest, bf, iblt, positive, negative,
+                                               m_iblt, m_arena, m_keyChain));
+}
+
+SyncOutcome
+LogicRepo::decideSyncReply(const ndn::Interest& interest, const bloom_filter& bf, const IBLT& iblt,
+                           const KeySet& positive, const KeySet& negative, const IBLT& state,
+                           Arena& arena, ndn::KeyChain& keyChain) const
+{
+  //assert((positive.size() == 1 && negative.size() == 1) || (positive.size() == 0 && negative.size() == 0));
+
+  SyncOutcome outcome;
 
-  return ans;
+  // generate content in Sync reply
+  ArenaString content = getSyncContent(positive, bf, arena);
+
+  if (positive.size() + negative.size() >= m_threshold || !content.empty()) {
+    // send back data
+    outcome.reply = makeSyncData(interest.getName(), state, content, arena, keyChain);
+  }
+  else {
+    outcome.pending = std::make_shared<PendingEntryInfo>(bf, iblt, positive.size() + negative.size());
+  }
+  return outcome;
 }
 
 void
-LogicRepo::updateSeq(std::string prefix, uint32_t seq)
+LogicRepo::finishSyncInterest(const ndn::Interest& interest, const SyncOutcome& outcome)
 {
-  if (m_prefixes[prefix] >= seq) {
+  if (outcome.reply != nullptr) {
+    m_face.put(*outcome.reply);
     return;
   }
 
-  if (m_prefixes.find(prefix) != m_prefixes.end() && m_prefixes[prefix] != 0) {
-    uint32_t hash = m_prefix2hash[prefix + "/" + std::to_string(m_prefixes[prefix])];
-    m_prefix2hash.erase(prefix + "/" + std::to_string(m_prefixes[prefix]));
-    m_hash2prefix.erase(hash);
-    m_iblt.erase(hash);
+  // add the entry to the pending entry, sharing equal filters and tables
+  PendingEntryInfo entry = *outcome.pending;
+  entry.bf = m_bfPool.intern(entry.bf);
+  entry.iblt = m_ibltPool.intern(entry.iblt);
+  const ndn::Name& interestName = interest.getName();
+  auto inserted = m_pendingEntries.insert(std::map<ndn::Name, PendingEntryInfo>::value_type(interestName, entry));
+  if (!inserted.second) {
+    m_scheduler.cancelEvent(inserted.first->second.expirationEvent);
   }
+  else {
+    m_subscriptions.add(*inserted.first->second.bf);
+  }
+  inserted.first->second.expirationEvent = m_scheduler.scheduleEvent(interest.getInterestLifetime(),
+                                                [this, interestName] () {
+                                                  erasePendingEntry(interestName);
+                                                  });
+  m_metrics.pendingEntries.record(m_pendingEntries.size());
 
-  m_prefixes[prefix] = seq;
-  std::string prefixWithSeq = prefix + "/" + std::to_string(m_prefixes[prefix]);
-  uint32_t newHash = MurmurHash3(N_HASHCHECK, ParseHex(prefixWithSeq));
-  m_prefix2hash[prefixWithSeq] = newHash;
-  m_hash2prefix[newHash] = prefix;
-  m_iblt.insert(newHash);
+}
 
-  std::vector <ndn::Name> prefixToErase;
-  
-  for (auto pendingInterest : m_pendingEntries) {
-    // go through each pendingEntries
-    PendingEntryInfo entry = pendingInterest.second; 
-    IBLT diff = m_iblt - entry.iblt;
-    std::set<uint32_t> positive;
-    std::set<uint32_t> negative;
-
-    if (!diff.listEntries(positive, negative)) {
-      this->sendNack(pendingInterest.first);
-      m_pendingEntries.erase(pendingInterest.first);
-      m_scheduler.cancelEvent(entry.expirationEvent);
-      continue;
-      //return;
-    }
+void
+LogicRepo::onSyncRegisterFailed(const ndn::Name& prefix, const std::string& msg)
+{
+  std::cout << ">> Logic::onSyncRegisterFailed" << std::endl;
+}
 
-    if (entry.bf.contains(prefix) || positive.size() + negative.size() >= m_threshold) {
-      // generate sync data and cancel the scheduler
-      ndn::Name syncDataName = pendingInterest.first;
-      appendIBLT(syncDataName);
-      std::string syncContent;
-      if (entry.bf.contains(prefix)) {
-        syncContent = prefix + " " + std::to_string(m_prefixes[prefix]);
-      }
+bool
+LogicRepo::hasValidBF(const ndn::Name& interestName, std::size_t index)
+{
+  uint64_t hashId = interestName.get(index-1).toNumber();
+  uint64_t count = interestName.get(index).toNumber();
+  uint64_t fpMilli = interestName.get(index+1).toNumber();
+  if (!isKnownHash(hashId) || count == 0 || count > std::numeric_limits<uint32_t>::max() ||
+      fpMilli == 0 || fpMilli >= 1000) {
+    return false;
+  }
 
-      ndn::shared_ptr<ndn::Data> syncData = ndn::make_shared<ndn::Data>(syncDataName);
-      syncData->setContent(reinterpret_cast<const uint8_t*>(syncContent.c_str()), syncContent.length());
-      syncData->setFreshnessPeriod(m_syncReplyFreshness);
-      m_keyChain.sign(*syncData);
-      m_face.put(*syncData);
+  // any other table size would index past the subscription counters
+  std::shared_ptr<const bloom_shape> shape = bloom_shape::get(count, fpMilli, hashId);
+  return interestName.get(index+3).value_size() == shape->raw_table_size;
+}
 
-      prefixToErase.push_back(pendingInterest.first);
-      m_scheduler.cancelEvent(entry.expirationEvent);
-    }
-  }
+bloom_filter
+LogicRepo::decodeBF(const ndn::Name& interestName, std::size_t index, Arena& arena) const
+{
+  // count, fp*1000, table size, table, after the hash id of the filter
+  const ndn::name::Component& bfName = interestName.get(index+3);
 
-  for (auto pte : prefixToErase) {
-    m_pendingEntries.erase(pte);
-  }
+  bloom_filter bf(bloom_shape::get(interestName.get(index).toNumber(),
+                                  interestName.get(index+1).toNumber(),
+                                  interestName.get(index-1).toNumber()),
+                  &arena);
+  bf.setTable(bfName.value(), bfName.value_size());
+  return bf;
 }
 
-}
\ No newline at end of file
+void
+LogicRepo::appendIBLT(ndn::Name& name, const IBLT& iblt, Arena& arena) const
+{
+  std::vector <uint8_t, ArenaAllocator<uint8_t> > table(iblt.encodedSize(), 0, &arena);
+  iblt.encode(table.data());
+
+  name.appendNumber(table.size());
+  name.append(table.begin(), table.end());
+}
+
+ArenaString
+LogicRepo::getSyncContent(const KeySet& positive, const bloom_filter& bf, Arena& arena) const
+{
+  ArenaString content(&arena);
+  std::lock_guard<std::mutex> lock(m_nameMutex);
+  for (auto hash : positive) {
+    auto it = m_hash2id.find(hash);
+    if (it == m_hash2id.end())
+      continue;
+
+    appendIfSubscribed(content, it->second, bf, arena);
+  }
+  return content;
+}
+
+ArenaString
+LogicRepo::getLeafContent(std::size_t leaf, const bloom_filter& bf, Arena& arena) const
+{
+  ArenaString content(&arena);
+  std::lock_guard<std::mutex> lock(m_nameMutex);
+  for (auto key : m_leafKeys[leaf]) {
+    appendIfSubscribed(content, m_hash2id.find(key)->second, bf, arena);
+  }
+  return content;
+}
+
+void
+LogicRepo::appendIfSubscribed(ArenaString& content, NameTrie::Id id, const bloom_filter& bf,
+                              Arena& arena) const
+{
+  // the name is written in place and taken back if not subscribed
+  std::size_t start = content.size();
+  m_names.appendName(id, content);
+  bloom_key key(content.data() + start, content.size() - start, &arena);
+  if (!bf.contains(key)) {
+    content.resize(start);
+    return;
+  }
+
+  appendSeqLine(content, m_producers[id].seq);
+}
+
+ndn::shared_ptr<ndn::Data>
+LogicRepo::makeSyncData(const ndn::Name& interestName, const IBLT& iblt, const ArenaString& content,
+                        Arena& arena, ndn::KeyChain& keyChain) const
+{
+  ndn::Name syncDataName = interestName;
+  appendIBLT(syncDataName, iblt, arena);
+
+  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>(syncDataName);
+  data->setFreshnessPeriod(m_syncReplyFreshness);
+  data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+  m_signingPolicy.sign(*data, SigningPolicy::SYNC_REPLY, keyChain);
+
+  m_metrics.syncReplies.increment();
+  m_metrics.replySize.record(data->wireEncode().size());
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_SYNC_REPLY, 0, data->wireEncode().size());
+  return data;
+}
+
+ndn::shared_ptr<ndn::Data>
+LogicRepo::makePartial(const ndn::Name& interestName, const IBLT& iblt, const bloom_filter& bf,
+                       const KeySet& positive, const KeySet& negative,
+                       Arena& arena, ndn::KeyChain& keyChain) const
+{
+  // Peeling stalled after recovering part of the difference. Reply with
+  // what was recovered and the consumer's IBLT advanced by exactly those
+  // keys, so the consumer gets them without a hello. The follow-up round
+  // only carries the remainder, and falls back to a delta hello through
+  // a NACK if that does not peel either.
+  IBLT advanced(iblt, &arena);
+  for (auto hash : positive) {
+    advanced.insert(hash);
+  }
+  for (auto hash : negative) {
+    advanced.erase(hash);
+  }
+
+  PSYNC_TRACE(trace::LEVEL_INFO, trace::EVENT_PARTIAL, 0, positive.size() + negative.size());
+  ArenaString content = getSyncContent(positive, bf, arena);
+  content.append("CONTINUE 0\n");
+  return makeSyncData(interestName, advanced, content, arena, keyChain);
+}
+
+ndn::shared_ptr<ndn::Data>
+LogicRepo::makeNack(const ndn::Name& interestName, ndn::KeyChain& keyChain) const
+{
+  m_metrics.nacks.increment();
+  PSYNC_TRACE(trace::LEVEL_INFO, trace::EVENT_NACK, 0, 0);
+
+  std::string content = "NACK 0";
+  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>();
+  data->setName(interestName);
+  data->setFreshnessPeriod(m_syncReplyFreshness);
+  data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+  m_signingPolicy.sign(*data, SigningPolicy::NACK_REPLY, keyChain);
+  return data;
+}
+
+void
+LogicRepo::updateSeq(std::string prefix, uint32_t seq)
+{
+  if (!isOwned(prefix)) {
+    m_metrics.foreignDrops.increment();
+    return;
+  }
+  if (applySeq(prefix, seq)) {
+    schedulePendingPass();
+  }
+}
+
+std::size_t
+LogicRepo::bulkLoad(const std::vector<std::pair<std::string, uint32_t> >& table, std::size_t nThreads)
+{
+  if (!m_ring.empty()) {
+    std::vector<std::pair<std::string, uint32_t> > owned;
+    owned.reserve(table.size());
+    for (const auto& row : table) {
+      if (isOwned(row.first))
+        owned.push_back(row);
+    }
+    if (owned.size() != table.size()) {
+      m_metrics.foreignDrops.increment(table.size() - owned.size());
+      return bulkLoad(owned, nThreads);
+    }
+  }
+
+  if (nThreads == 0) {
+    nThreads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  nThreads = std::min<std::size_t>(nThreads, table.size() / 1024 + 1);
+
+  // Hashing "prefix/seq" twice per key dominates, so every thread keys
+  // its slice of the table into a partial IBLT, and the partial tables
+  // add up to the one of the whole table.
+  std::vector <IBLT::Key> keys(table.size());
+  std::vector <IBLT> partials(nThreads, IBLT(m_expectedNumEntries));
+  std::vector <std::thread> threads;
+  for (std::size_t t = 0; t < nThreads; t++) {
+    threads.emplace_back([&, t] {
+        std::string name;
+        for (std::size_t i = table.size() * t / nThreads; i < table.size() * (t + 1) / nThreads; i++) {
+          if (table[i].second == 0)
+            continue;
+          name.assign(table[i].first).append("/").append(std::to_string(table[i].second));
+          keys[i] = IBLT::makeKey(name);
+          partials[t].insert(keys[i]);
+        }
+      });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& partial : partials) {
+    m_iblt += partial;
+  }
+
+  // The trie and the key index take one writer, but no hashing is left
+  // for it. Entries that do not advance their prefix, already known or
+  // repeated in the table, are taken back out of the merged table.
+  std::size_t nChanged = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    m_hash2id.reserve(m_hash2id.size() + table.size());
+    for (std::size_t i = 0; i < table.size(); i++) {
+      const std::string& prefix = table[i].first;
+      uint32_t seq = table[i].second;
+      NameTrie::Id id = m_names.find(prefix);
+      bool isAdded = id == NameTrie::INVALID_ID;
+      if (isAdded) {
+        id = addName(prefix);
+      }
+      if (seq == 0) {
+        nChanged += isAdded;
+        continue;
+      }
+
+      ProducerState& producer = m_producers[id];
+      if (producer.seq >= seq) {
+        m_iblt.erase(keys[i]);
+        continue;
+      }
+      if (producer.seq != 0) {
+        m_hash2id.erase(producer.hash);
+        m_iblt.erase(producer.hash);
+        eraseTreeKey(producer.hash);
+      }
+
+      ++nChanged;
+      producer.seq = seq;
+      producer.hash = keys[i];
+      markChanged(id);
+      m_hash2id[keys[i]] = id;
+      insertTreeKey(keys[i]);
+      if (!m_pendingEntries.empty() || !m_pendingTreeEntries.empty()) {
+        m_changedPrefixes.push_back(prefix);
+      }
+    }
+  }
+  ++m_version;
+
+  // one jump, replaying it would cost more than the consumer's full IBLT
+  m_historyStart += m_history.size();
+  m_history.clear();
+  m_digest2history.clear();
+  // but consumers caught up with the loaded state replay from there
+  recordHistory(false, 0, false, 0);
+
+  addLoadFilter(table);
+  schedulePendingPass();
+  return nChanged;
+}
+
+bool
+LogicRepo::bulkLoadFile(const std::string& path, std::size_t nThreads)
+{
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+
+  std::vector <std::pair<std::string, uint32_t> > table;
+  std::string prefix;
+  uint32_t seq;
+  while (file >> prefix >> seq) {
+    table.push_back(std::make_pair(prefix, seq));
+  }
+  if (file.bad() || !file.eof()) {
+    return false;
+  }
+
+  bulkLoad(table, nThreads);
+  return true;
+}
+
+void
+LogicRepo::addLoadFilter(const std::vector<std::pair<std::string, uint32_t> >& table)
+{
+  if (table.empty()) {
+    return;
+  }
+
+  // longest common prefix of the names, cut back to a component boundary
+  std::string common = table.front().first;
+  for (const auto& entry : table) {
+    const std::string& prefix = entry.first;
+    std::size_t length = 0;
+    while (length < common.size() && length < prefix.size() && common[length] == prefix[length]) {
+      ++length;
+    }
+    common.resize(length);
+  }
+  bool isBoundary = true;
+  for (const auto& entry : table) {
+    if (entry.first.size() > common.size() && entry.first[common.size()] != '/') {
+      isBoundary = false;
+      break;
+    }
+  }
+  if (!isBoundary) {
+    common.resize(common.rfind('/') == std::string::npos ? 0 : common.rfind('/'));
+  }
+
+  // with no common root, "/" would take every interest the forwarder has
+  std::set <std::string> roots;
+  if (!common.empty() && common != "/") {
+    roots.insert(common);
+  }
+  else {
+    for (const auto& entry : table) {
+      std::string root = entry.first.substr(0, entry.first.find('/', 1));
+      if (!root.empty() && root != "/")
+        roots.insert(root);
+    }
+  }
+
+  for (const auto& root : roots) {
+    ndn::Name filter(root);
+    bool isCovered = false;
+    for (const auto& loaded : m_loadFilters) {
+      if (loaded.isPrefixOf(filter)) {
+        isCovered = true;
+        break;
+      }
+    }
+    if (isCovered)
+      continue;
+    m_loadFilters.push_back(filter);
+    m_face.setInterestFilter(filter,
+                             bind(&LogicRepo::onInterest, this, _1, _2),
+                             [] (const ndn::Name& prefix, const std::string& msg) {});
+  }
+}
+
+bool
+LogicRepo::applySeq(const std::string& prefix, uint32_t seq)
+{
+  bool hasOldHash = false;
+  IBLT::Key oldHash = 0;
+  IBLT::Key newHash = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    NameTrie::Id id = m_names.find(prefix);
+    if (id == NameTrie::INVALID_ID) {
+      // updateSeq() has always added unknown prefixes
+      id = addName(prefix);
+    }
+
+    ProducerState& producer = m_producers[id];
+    if (producer.seq >= seq) {
+      return false;
+    }
+
+    if (producer.seq != 0) {
+      m_hash2id.erase(producer.hash);
+      m_iblt.erase(producer.hash);
+      eraseTreeKey(producer.hash);
+      hasOldHash = true;
+      oldHash = producer.hash;
+    }
+
+    producer.seq = seq;
+    markChanged(id);
+    newHash = IBLT::makeKey(prefix + "/" + std::to_string(seq));
+    producer.hash = newHash;
+    m_hash2id[newHash] = id;
+    m_iblt.insert(newHash);
+    insertTreeKey(newHash);
+  }
+  ++m_version;
+  recordHistory(hasOldHash, oldHash, true, newHash);
+  m_changedPrefixes.push_back(prefix);
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_UPDATE_SEQ, trace::nameId(prefix), seq);
+  return true;
+}
+
+void
+LogicRepo::schedulePendingPass()
+{
+  if (m_coalescingWindow == ndn::time::microseconds::zero()) {
+    satisfyPendingEntries();
+    return;
+  }
+
+  ndn::time::steady_clock::TimePoint now = ndn::time::steady_clock::now();
+  if (m_isPassScheduled) {
+    m_scheduler.cancelEvent(m_passEvent);
+  }
+  else {
+    m_isPassScheduled = true;
+    m_passDeadline = now + m_coalescingMaxDelay;
+  }
+
+  // restarted by every change, but not past the deadline
+  ndn::time::nanoseconds delay = std::min<ndn::time::nanoseconds>(m_coalescingWindow,
+                                                                   m_passDeadline - now);
+  m_passEvent = m_scheduler.scheduleEvent(std::max(delay, ndn::time::nanoseconds::zero()),
+                                          [this] { satisfyPendingEntries(); });
+}
+
+void
+LogicRepo::satisfyPendingEntries()
+{
+  if (m_isPassScheduled) {
+    m_scheduler.cancelEvent(m_passEvent);
+    m_isPassScheduled = false;
+  }
+
+  if (m_changedPrefixes.empty()) {
+    return;
+  }
+  if (m_tree != nullptr) {
+    satisfyTreeEntries();
+  }
+
+  // a prefix updated several times still adds at most its old and new hash
+  std::sort(m_changedPrefixes.begin(), m_changedPrefixes.end());
+  m_changedPrefixes.erase(std::unique(m_changedPrefixes.begin(), m_changedPrefixes.end()),
+                          m_changedPrefixes.end());
+  m_metrics.coalescedUpdates.record(m_changedPrefixes.size());
+
+  ArenaScope scope(m_arena);
+  std::vector <ndn::Name, ArenaAllocator<ndn::Name> > prefixToErase(&m_arena);
+  // reserved up front, growing it under entryScope below would be rewound
+  prefixToErase.reserve(m_pendingEntries.size());
+
+  // each update adds at most two differences (old and new hash) to every
+  // pending entry, so an entry that does not subscribe to any changed
+  // prefix only needs decoding once its bound reaches the threshold
+  bool subscribed = false;
+  for (const auto& prefix : m_changedPrefixes) {
+    ArenaScope keyScope(m_arena);
+    bloom_key key(prefix, &m_arena);
+    if (m_subscriptions.mayContain(key)) {
+      subscribed = true;
+      break;
+    }
+  }
+  uint32_t nDiffs = 2 * m_changedPrefixes.size();
+  m_changedPrefixes.clear();
+
+  for (auto& pendingInterest : m_pendingEntries) {
+    // go through each pendingEntries
+    PendingEntryInfo& entry = pendingInterest.second;
+    entry.diffBound += nDiffs;
+    if (!subscribed && entry.diffBound < m_threshold) {
+      continue;
+    }
+
+    if (m_workers != nullptr) {
+      dispatchPendingEntry(pendingInterest.first, entry);
+      continue;
+    }
+
+    // rewound per entry, only the erase list outlives the iteration
+    ArenaScope entryScope(m_arena);
+    ndn::shared_ptr<ndn::Data> reply =
+      processPendingEntry(pendingInterest.first, *entry.bf, *entry.iblt, m_iblt,
+                          entry.diffBound, m_arena, m_keyChain);
+    if (reply != nullptr) {
+      m_face.put(*reply);
+      prefixToErase.push_back(pendingInterest.first);
+    }
+  }
+
+  for (auto pte : prefixToErase) {
+    erasePendingEntry(pte);
+  }
+  m_metrics.pendingEntries.record(m_pendingEntries.size());
+}
+
+ndn::shared_ptr<ndn::Data>
+LogicRepo::processPendingEntry(const ndn::Name& interestName, const bloom_filter& bf,
+                               const IBLT& iblt, const IBLT& state, uint32_t& diffBound,
+                               Arena& arena, ndn::KeyChain& keyChain) const
+{
+  IBLT diff(state, &arena);
+  diff -= iblt;
+  KeySet positive(&arena);
+  KeySet negative(&arena);
+
+  bool isComplete = diff.listEntries(positive, negative);
+  recordPeel(isComplete, positive.size() + negative.size());
+  if (!isComplete) {
+    if (positive.empty() && negative.empty()) {
+      return makeNack(interestName, keyChain);
+    }
+    return makePartial(interestName, iblt, bf, positive, negative, arena, keyChain);
+  }
+  diffBound = positive.size() + negative.size();
+
+  // every changed prefix the entry subscribes to, however many changed
+  ArenaString syncContent = getSyncContent(positive, bf, arena);
+  if (!syncContent.empty() || positive.size() + negative.size() >= m_threshold) {
+    // generate sync data and cancel the scheduler
+    return makeSyncData(interestName, state, syncContent, arena, keyChain);
+  }
+
+  return nullptr;
+}
+
+void
+LogicRepo::dispatchPendingEntry(const ndn::Name& interestName, const PendingEntryInfo& entry)
+{
+  std::shared_ptr<const RepoSnapshot> snapshot = getSnapshot();
+  std::shared_ptr<const bloom_filter> bf = entry.bf;
+  std::shared_ptr<const IBLT> iblt = entry.iblt;
+  std::weak_ptr<bool> alive = m_alive;
+
+  m_workers->submit([=] {
+      Arena& arena = workerArena();
+      ArenaScope scope(arena);
+
+      uint32_t diffBound = 0;
+      ndn::shared_ptr<ndn::Data> reply =
+        processPendingEntry(interestName, *bf, *iblt, snapshot->iblt, diffBound,
+                            arena, SigningPolicy::threadKeyChain());
+      m_face.getIoService().post([=] {
+          if (alive.expired())
+            return;
+
+          // answered, expired or replaced by a newer interest in the meantime
+          auto it = m_pendingEntries.find(interestName);
+          if (it == m_pendingEntries.end() || it->second.iblt != iblt)
+            return;
+
+          if (reply != nullptr) {
+            m_face.put(*reply);
+            erasePendingEntry(interestName);
+            m_metrics.pendingEntries.record(m_pendingEntries.size());
+          }
+          else if (snapshot->version == m_version) {
+            it->second.diffBound = diffBound;
+          }
+        });
+    });
+}
+
+void
+LogicRepo::recordHistory(bool hasRemoved, IBLT::Key removed, bool hasAdded, IBLT::Key added)
+{
+  if (m_historySize == 0) {
+    return;
+  }
+
+  HistoryEntry change;
+  change.digest = m_iblt.getDigest();
+  change.hasRemoved = hasRemoved;
+  change.removed = removed;
+  change.hasAdded = hasAdded;
+  change.added = added;
+
+  m_history.push_back(change);
+  m_digest2history[change.digest] = m_historyStart + m_history.size() - 1;
+  setHistorySize(m_historySize);
+}
+
+void
+LogicRepo::recordPeel(bool isComplete, std::size_t nPeeled) const
+{
+  if (isComplete)
+    m_metrics.peelComplete.increment();
+  else if (nPeeled > 0)
+    m_metrics.peelPartial.increment();
+  else
+    m_metrics.peelStalled.increment();
+}
+
+void
+LogicRepo::erasePendingEntry(const ndn::Name& interestName)
+{
+  auto it = m_pendingEntries.find(interestName);
+  if (it == m_pendingEntries.end()) {
+    return;
+  }
+
+  m_scheduler.cancelEvent(it->second.expirationEvent);
+  m_subscriptions.remove(*it->second.bf);
+  m_pendingEntries.erase(it);
+}
+
+void
+LogicRepo::addReplica(const ndn::Name& peerPrefix)
+{
+  auto inserted = m_replicas.insert(std::make_pair(peerPrefix, ReplicaPeer()));
+  // a peer followed for a handoff is now followed for good
+  inserted.first->second.isOwnedOnly = false;
+  if (inserted.second) {
+    sendReplicaHello(peerPrefix);
+  }
+}
+
+void
+LogicRepo::onReplicaDataInterest(const ndn::Name& prefix, const ndn::Interest& interest)
+{
+  // <sync>/data/<publication name>, the publication keeps its signature.
+  // Empty content if it is not here, e.g. a prefix advanced by updateSeq().
+  ndn::shared_ptr<const ndn::Data> published = m_ims.find(interest.getName().getSubName(prefix.size()));
+
+  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>(interest.getName());
+  data->setFreshnessPeriod(m_syncReplyFreshness);
+  if (static_cast<bool>(published)) {
+    const ndn::Block& wire = published->wireEncode();
+    data->setContent(wire.wire(), wire.size());
+  }
+  m_signingPolicy.sign(*data, SigningPolicy::SYNC_REPLY, m_keyChain);
+  m_face.put(*data);
+}
+
+void
+LogicRepo::sendReplicaHello(const ndn::Name& peer)
+{
+  // no longer followed
+  if (m_replicas.find(peer) == m_replicas.end()) {
+    return;
+  }
+
+  ndn::Name helloInterestName = peer;
+  helloInterestName.append("hello");
+
+  ndn::Interest helloInterest(helloInterestName);
+  helloInterest.setInterestLifetime(ndn::time::milliseconds(1000));
+  helloInterest.setMustBeFresh(true);
+  m_face.expressInterest(helloInterest,
+                         [this, peer] (const ndn::Interest&, const ndn::Data& data) {
+                           onReplicaHello(peer, data);
+                         },
+                         [this, peer] (const ndn::Interest&) { sendReplicaHello(peer); });
+}
+
+void
+LogicRepo::sendReplicaSync(const ndn::Name& peer)
+{
+  auto replica = m_replicas.find(peer);
+  if (replica == m_replicas.end()) {
+    return;
+  }
+
+  // count 1 with fp 0.001 subscribes to every prefix, the table is unused
+  bloom_filter bf(bloom_shape::get(1, 1));
+  ndn::Name syncInterestName = peer;
+  syncInterestName.append("sync");
+  syncInterestName.appendNumber(bf.shape()->hash_id);
+  syncInterestName.appendNumber(1);
+  syncInterestName.appendNumber(1);
+  syncInterestName.appendNumber(bf.getTableSize());
+  syncInterestName.append(bf.begin(), bf.end());
+  syncInterestName.append(replica->second.iblt);
+
+  ndn::Interest syncInterest(syncInterestName);
+  syncInterest.setInterestLifetime(ndn::time::milliseconds(1000));
+  syncInterest.setMustBeFresh(true);
+  m_face.expressInterest(syncInterest,
+                         [this, peer] (const ndn::Interest&, const ndn::Data& data) {
+                           onReplicaSync(peer, data);
+                         },
+                         [this, peer] (const ndn::Interest&) { sendReplicaSync(peer); });
+}
+
+void
+LogicRepo::onReplicaHello(const ndn::Name& peer, const ndn::Data& data)
+{
+  auto replica = m_replicas.find(peer);
+  if (replica == m_replicas.end()) {
+    return;
+  }
+
+  // the full prefix list, and the peer IBLT at the end of the name
+  const ndn::Name& helloDataName = data.getName();
+  replica->second.iblt = helloDataName.getSubName(helloDataName.size()-2, 2);
+  addReplicaUpdates(peer, data.getContent());
+  sendReplicaSync(peer);
+}
+
+void
+LogicRepo::onReplicaSync(const ndn::Name& peer, const ndn::Data& data)
+{
+  auto replica = m_replicas.find(peer);
+  if (replica == m_replicas.end()) {
+    return;
+  }
+
+  const ndn::Block& content = data.getContent();
+  if (content.value_size() >= 4 && std::memcmp(content.value(), "NACK", 4) == 0) {
+    // too far behind to peel, start over from the full list
+    sendReplicaHello(peer);
+    return;
+  }
+
+  const ndn::Name& syncDataName = data.getName();
+  replica->second.iblt = syncDataName.getSubName(syncDataName.size()-2, 2);
+  addReplicaUpdates(peer, content);
+  sendReplicaSync(peer);
+}
+
+void
+LogicRepo::addReplicaUpdates(const ndn::Name& peer, const ndn::Block& content)
+{
+  std::stringstream ss(std::string(reinterpret_cast<const char*>(content.value()),
+                                   content.value_size()));
+  std::string prefix;
+  uint32_t seq;
+  bool isChanged = false;
+  while (ss >> prefix >> seq) {
+    if (prefix == "CONTINUE" || !isOwned(prefix)) {
+      continue;
+    }
+    if (m_names.find(prefix) == NameTrie::INVALID_ID) {
+      // served from here from now on, like the peer does
+      addSyncNode(prefix);
+    }
+
+    // The tables converge on the peer's sequence numbers whether or not
+    // any publication is behind them, e.g. after updateSeq() or
+    // bulkLoad(). The publications follow as far as a peer has them.
+    uint32_t oldSeq = getSeq(prefix);
+    if (!applySeq(prefix, seq)) {
+      continue;
+    }
+    m_metrics.replicaUpdates.increment();
+    isChanged = true;
+
+    uint32_t first = std::max(oldSeq + 1,
+                              seq > MAX_REPLICA_BACKFILL ? seq - MAX_REPLICA_BACKFILL + 1 : 1);
+    for (uint32_t s = seq; s >= first && m_replicaFetchNames.size() < MAX_REPLICA_FETCH_NAMES; s--) {
+      ndn::Name dataName(prefix);
+      dataName.appendNumber(s);
+      // copied from another peer already, or on its way
+      if (!m_replicaFetchNames.insert(dataName).second) {
+        continue;
+      }
+
+      ReplicaFetch fetch;
+      fetch.peer = peer;
+      fetch.prefix = prefix;
+      fetch.seq = s;
+      fetch.nFailures = 0;
+      m_replicaFetchQueue.push_back(fetch);
+    }
+  }
+  if (isChanged) {
+    schedulePendingPass();
+  }
+  fetchReplicaData();
+}
+
+void
+LogicRepo::fetchReplicaData()
+{
+  while (m_nReplicaFetching < MAX_REPLICA_FETCHES && !m_replicaFetchQueue.empty()) {
+    ReplicaFetch fetch = m_replicaFetchQueue.front();
+    m_replicaFetchQueue.pop_front();
+
+    ndn::Name interestName = fetch.peer;
+    interestName.append("data").append(ndn::Name(fetch.prefix)).appendNumber(fetch.seq);
+    ndn::Interest interest(interestName);
+    interest.setInterestLifetime(ndn::time::milliseconds(1000));
+    interest.setMustBeFresh(true);
+
+    ++m_nReplicaFetching;
+    m_face.expressInterest(interest,
+                           [this, fetch] (const ndn::Interest&, const ndn::Data& data) {
+                             --m_nReplicaFetching;
+                             onReplicaData(fetch, data);
+                           },
+                           [this, fetch] (const ndn::Interest&) {
+                             --m_nReplicaFetching;
+                             onReplicaFetchTimeout(fetch);
+                           });
+  }
+}
+
+void
+LogicRepo::onReplicaData(const ReplicaFetch& fetch, const ndn::Data& data)
+{
+  const ndn::Block& content = data.getContent();
+  bool isCopied = false;
+  if (content.value_size() > 0) {
+    try {
+      ndn::Data published(ndn::Block(content.value(), content.value_size()));
+      if (published.getName() == ndn::Name(fetch.prefix).appendNumber(fetch.seq)) {
+        m_ims.insert(published);
+        isCopied = true;
+      }
+    }
+    catch (const ndn::tlv::Error&) {
+    }
+  }
+
+  if (!isCopied) {
+    // the peer lacks it too, ask again later or elsewhere
+    retryReplicaFetch(fetch, true);
+    return;
+  }
+  m_metrics.replicaFetches.increment();
+  finishReplicaFetch(fetch);
+}
+
+void
+LogicRepo::onReplicaFetchTimeout(const ReplicaFetch& fetch)
+{
+  retryReplicaFetch(fetch, false);
+}
+
+void
+LogicRepo::retryReplicaFetch(const ReplicaFetch& fetch, bool isDelayed)
+{
+  ReplicaFetch retry = fetch;
+  ++retry.nFailures;
+  // the prefix has advanced already, the publication may exist nowhere
+  if (retry.nFailures >= MAX_REPLICA_FETCH_RETRIES * static_cast<int>(m_replicas.size())) {
+    m_metrics.replicaFetchMisses.increment();
+    finishReplicaFetch(fetch);
+    return;
+  }
+  if (retry.nFailures % MAX_REPLICA_FETCH_RETRIES == 0 ||
+      m_replicas.find(retry.peer) == m_replicas.end()) {
+    auto peer = m_replicas.upper_bound(retry.peer);
+    if (peer == m_replicas.end()) {
+      peer = m_replicas.begin();
+    }
+    retry.peer = peer->first;
+  }
+
+  if (!isDelayed) {
+    m_replicaFetchQueue.push_back(retry);
+    fetchReplicaData();
+    return;
+  }
+  m_scheduler.scheduleEvent(REPLICA_RETRY_DELAY, [this, retry] {
+      m_replicaFetchQueue.push_back(retry);
+      fetchReplicaData();
+    });
+}
+
+void
+LogicRepo::finishReplicaFetch(const ReplicaFetch& fetch)
+{
+  m_replicaFetchNames.erase(ndn::Name(fetch.prefix).appendNumber(fetch.seq));
+  fetchReplicaData();
+}
+
+void
+LogicRepo::setPartitions(const PartitionRing& ring, ndn::time::milliseconds handoffDelay)
+{
+  // partitions leaving with this change hand over their prefixes as well
+  std::set <std::string> peers(m_ring.getPartitions().begin(), m_ring.getPartitions().end());
+  peers.insert(ring.getPartitions().begin(), ring.getPartitions().end());
+  peers.erase(m_syncPrefix.toUri());
+  m_ring = ring;
+
+  // follow them for the prefixes now owned here until the handoff is over,
+  // publications made there in the meantime are copied as well
+  for (const auto& peer : peers) {
+    ndn::Name peerPrefix(peer);
+    if (m_replicas.find(peerPrefix) != m_replicas.end())
+      continue;
+    ReplicaPeer& replica = m_replicas[peerPrefix];
+    replica.isOwnedOnly = true;
+    sendReplicaHello(peerPrefix);
+  }
+
+  // a later change restarts the handoff
+  uint64_t handoff = ++m_handoffCount;
+  m_scheduler.scheduleEvent(handoffDelay, [this, handoff] {
+      if (handoff == m_handoffCount)
+        finishHandoff();
+    });
+}
+
+bool
+LogicRepo::isOwned(const std::string& prefix) const
+{
+  return m_ring.empty() || m_ring.getPartition(prefix) == m_syncPrefix.toUri();
+}
+
+void
+LogicRepo::finishHandoff()
+{
+  for (auto it = m_replicas.begin(); it != m_replicas.end();) {
+    if (it->second.isOwnedOnly)
+      it = m_replicas.erase(it);
+    else
+      ++it;
+  }
+  std::vector <std::string> foreign;
+  m_names.forEach([&] (NameTrie::Id id, const std::string& name) {
+      if (!isOwned(name))
+        foreign.push_back(name);
+    });
+
+
+  // their new owners have copied them by now
+  for (const auto& prefix : foreign) {
+    removeSyncNode(prefix);
+    m_ims.erase(ndn::Name(prefix));
+    if (!m_pendingEntries.empty() || !m_pendingTreeEntries.empty()) {
+      m_changedPrefixes.push_back(prefix);
+    }
+  }
+  m_metrics.handoffDrops.increment(foreign.size());
+  if (!foreign.empty()) {
+    // consumers parked on them learn they are gone
+    schedulePendingPass();
+  }
+}
+
+void
+LogicRepo::enableTreeSync(std::size_t fanout, std::size_t depth, std::size_t leafEntries)
+{
+  bool isRegistered = m_tree != nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    m_tree.reset(new IBLTTree(fanout, depth, leafEntries));
+    m_leafKeys.assign(m_tree->getNumLeaves(), std::vector<IBLT::Key>());
+    for (const auto& entry : m_hash2id) {
+      insertTreeKey(entry.first);
+    }
+  }
+
+  // parked against the old shape
+  while (!m_pendingTreeEntries.empty()) {
+    eraseTreeEntry(m_pendingTreeEntries.begin()->first);
+  }
+  if (isRegistered) {
+    return;
+  }
+
+  ndn::Name treeName = m_syncPrefix;
+  treeName.append("tree");
+  m_face.setInterestFilter(treeName,
+                           bind(&LogicRepo::onTreeInterest, this, _1, _2),
+                           bind(&LogicRepo::onSyncRegisterFailed, this, _1, _2));
+}
+
+void
+LogicRepo::onTreeInterest(const ndn::Name& prefix, const ndn::Interest& interest)
+{
+  m_metrics.treeInterests.increment();
+  ScopedTimer timer(m_metrics.syncProcessingTime);
+  ArenaScope scope(m_arena);
+  const ndn::Name& interestName = interest.getName();
+
+  // <tree>/<fanout>/<depth>/<leaf entries>/<hash id>/<BF>/<level>/<index>/<payload>,
+  // the payload being the child digests of a node or the table of a leaf
+  std::size_t depth = m_tree->getDepth();
+  if (interestName.size() != prefix.size() + 11 ||
+      interestName.get(prefix.size()).toNumber() != m_tree->getFanout() ||
+      interestName.get(prefix.size() + 1).toNumber() != depth ||
+      interestName.get(prefix.size() + 2).toNumber() != m_tree->getLeafEntries() ||
+      !hasValidBF(interestName, prefix.size() + 4)) {
+    // a tree of another shape
+    m_face.put(*makeNack(interestName, m_keyChain));
+    return;
+  }
+
+  uint64_t level = interestName.get(prefix.size() + 8).toNumber();
+  uint64_t index = interestName.get(prefix.size() + 9).toNumber();
+  if (level > depth || index >= m_tree->getWidth(level)) {
+    m_face.put(*makeNack(interestName, m_keyChain));
+    return;
+  }
+
+  bloom_filter bf = decodeBF(interestName, prefix.size() + 4, m_arena);
+  if (level == depth) {
+    onTreeLeafInterest(interestName, bf, index);
+    return;
+  }
+
+  const ndn::name::Component& digests = interestName.get(-1);
+  std::vector<std::size_t> children;
+  if (!m_tree->getDifferingChildren(level, index, digests.value(), digests.value_size(),
+                                    children)) {
+    m_face.put(*makeNack(interestName, m_keyChain));
+    return;
+  }
+  PSYNC_TRACE(trace::LEVEL_DEBUG, trace::EVENT_SYNC_INTEREST, 2, children.size());
+
+  if (!children.empty()) {
+    m_face.put(*makeTreeData(interestName, children));
+    return;
+  }
+
+  // the consumer is up to date below this node, wait for a change
+  PendingTreeEntry entry;
+  entry.level = level;
+  entry.index = index;
+  auto inserted = m_pendingTreeEntries.insert(std::make_pair(interestName, entry));
+  if (!inserted.second) {
+    m_scheduler.cancelEvent(inserted.first->second.expirationEvent);
+  }
+  ndn::Name entryName = interestName;
+  inserted.first->second.expirationEvent =
+    m_scheduler.scheduleEvent(interest.getInterestLifetime(),
+                              [this, entryName] { eraseTreeEntry(entryName); });
+}
+
+void
+LogicRepo::onTreeLeafInterest(const ndn::Name& interestName, const bloom_filter& bf,
+                              std::size_t leaf)
+{
+  const ndn::name::Component& table = interestName.get(-1);
+  IBLT iblt(m_tree->getLeafEntries(), &m_arena);
+  if (!iblt.decode(table.value(), table.value_size())) {
+    m_face.put(*makeNack(interestName, m_keyChain));
+    return;
+  }
+
+  const IBLT& state = m_tree->getLeafTable(leaf);
+  IBLT diff(state, &m_arena);
+  diff -= iblt;
+  KeySet positive(&m_arena);
+  KeySet negative(&m_arena);
+
+  bool isComplete = diff.listEntries(positive, negative);
+  recordPeel(isComplete, positive.size() + negative.size());
+
+  // Answered right away even if nothing subscribed changed: the consumer
+  // takes the leaf table from the reply, which ends its descent here.
+  // Where the table does not peel, the range is small enough to list.
+  ArenaString content(&m_arena);
+  if (isComplete) {
+    content = getSyncContent(positive, bf, m_arena);
+  }
+  else {
+    m_metrics.leafListings.increment();
+    content = getLeafContent(leaf, bf, m_arena);
+  }
+  m_face.put(*makeSyncData(interestName, state, content, m_arena, m_keyChain));
+}
+
+ndn::shared_ptr<ndn::Data>
+LogicRepo::makeTreeData(const ndn::Name& interestName, const std::vector<std::size_t>& children)
+{
+  ArenaString content(&m_arena);
+  for (auto child : children) {
+    content.append("DIFF");
+    appendSeqLine(content, child);
+  }
+
+  ndn::shared_ptr<ndn::Data> data = ndn::make_shared<ndn::Data>(interestName);
+  data->setFreshnessPeriod(m_syncReplyFreshness);
+  data->setContent(reinterpret_cast<const uint8_t*>(content.c_str()), content.length());
+  m_signingPolicy.sign(*data, SigningPolicy::SYNC_REPLY, m_keyChain);
+
+  m_metrics.syncReplies.increment();
+  m_metrics.replySize.record(data->wireEncode().size());
+  return data;
+}
+
+void
+LogicRepo::satisfyTreeEntries()
+{
+  ArenaScope scope(m_arena);
+  std::vector <ndn::Name> answered;
+  for (const auto& pending : m_pendingTreeEntries) {
+    const ndn::name::Component& digests = pending.first.get(-1);
+    std::vector<std::size_t> children;
+    m_tree->getDifferingChildren(pending.second.level, pending.second.index,
+                                 digests.value(), digests.value_size(), children);
+    if (!children.empty()) {
+      m_face.put(*makeTreeData(pending.first, children));
+      answered.push_back(pending.first);
+    }
+  }
+
+  for (const auto& interestName : answered) {
+    eraseTreeEntry(interestName);
+  }
+}
+
+void
+LogicRepo::eraseTreeEntry(const ndn::Name& interestName)
+{
+  auto it = m_pendingTreeEntries.find(interestName);
+  if (it == m_pendingTreeEntries.end()) {
+    return;
+  }
+
+  m_scheduler.cancelEvent(it->second.expirationEvent);
+  m_pendingTreeEntries.erase(it);
+}
+
+}
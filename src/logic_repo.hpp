@@ -1,7 +1,13 @@
 #ifndef LOGIC_REPO_HPP
 #define LOGIC_REPO_HPP
 
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <ndn-cxx/common.hpp>
@@ -12,22 +18,194 @@
 #include <ndn-cxx/security/key-chain.hpp>
 #include <ndn-cxx/security/validator.hpp>
 
+#include "arena.hpp"
 #include "iblt.hpp"
+#include "iblt_tree.hpp"
 #include "bloom_filter.hpp"
+#include "intern_pool.hpp"
+#include "metrics.hpp"
+#include "mpsc_queue.hpp"
+#include "name_trie.hpp"
+#include "partition_ring.hpp"
+#include "batch_signer.hpp"
+#include "signing_policy.hpp"
+#include "subscription_filter.hpp"
+#include "thread_pool.hpp"
 
 namespace psync {
 
+// keys of an IBLT difference, allocated from the per-request arena
+typedef std::set<IBLT::Key, std::less<IBLT::Key>, ArenaAllocator<IBLT::Key> > KeySet;
+
 struct PendingEntryInfo {
-  PendingEntryInfo(bloom_filter&bf, IBLT& iblt)
-  : bf(bf)
-  , iblt(iblt)
+  // bf and iblt may be arena temporaries, the copies made here are not.
+  // Once parked they are replaced by the pooled equal ones.
+  PendingEntryInfo(const bloom_filter& bf, const IBLT& iblt, uint32_t diffBound)
+  : bf(std::make_shared<bloom_filter>(bf))
+  , iblt(std::make_shared<IBLT>(iblt))
+  , diffBound(diffBound)
   {}
 
-  bloom_filter bf;
+  // never modified, so worker threads can read them while the entry changes
+  std::shared_ptr<const bloom_filter> bf;
+  std::shared_ptr<const IBLT> iblt;
+  // upper bound on the size of m_iblt - iblt, so entries that cannot
+  // have reached the threshold are skipped without decoding
+  uint32_t diffBound;
+  ndn::EventId expirationEvent;
+};
+
+// addresses of the pooled filters and tables of pending entries
+struct PendingStateHash {
+  std::size_t
+  operator()(const bloom_filter& bf) const;
+
+  std::size_t
+  operator()(const IBLT& iblt) const
+  {
+    return iblt.getDigest();
+  }
+};
+
+/**
+ * Repo IBLT as of one state version, handed to worker threads.
+ */
+struct RepoSnapshot {
+  uint64_t version;
   IBLT iblt;
+};
+
+/**
+ * What to do with a sync interest: put the signed reply, or keep the
+ * interest pending with the given entry.
+ */
+struct SyncOutcome {
+  ndn::shared_ptr<ndn::Data> reply;
+  std::shared_ptr<PendingEntryInfo> pending;
+};
+
+/**
+ * Outcome of a sync interest at the current state version, reused for
+ * byte-identical interests until m_iblt changes.
+ */
+struct CachedSyncOutcome {
+  ndn::Name interestName;
+  SyncOutcome outcome;
+};
+
+/**
+ * Sequence numbers and IBLT key of one producer prefix, by NameTrie id.
+ */
+struct ProducerState {
+  ProducerState()
+  : seq(0)
+  , publishedSeq(0)
+  , hash(0)
+  , changedAt(0)
+  , prevChange(NameTrie::INVALID_ID)
+  , nextChange(NameTrie::INVALID_ID)
+  {}
+
+  uint32_t seq;
+  uint32_t publishedSeq; // last sequence number handed out
+  IBLT::Key hash;        // of "prefix/seq", in m_iblt unless seq is 0
+  // name table version of the last add or advance, and the neighbours in
+  // the list of producers ordered by it
+  uint64_t changedAt;
+  NameTrie::Id prevChange;
+  NameTrie::Id nextChange;
+};
+
+/**
+ * A producer prefix removed at a name table version.
+ */
+struct RemovedName {
+  uint64_t version;
+  std::string prefix;
+};
+
+/**
+ * One change to the repo IBLT and the digest of the state it produced.
+ */
+struct HistoryEntry {
+  uint64_t digest;
+  bool hasRemoved;
+  IBLT::Key removed;
+  bool hasAdded;
+  IBLT::Key added;
+};
+
+/**
+ * A publication handed over by enqueuePublish(), applied on the face thread.
+ */
+struct PublishRequest {
+  std::string prefix;
+  ndn::Block content;
+  ndn::time::milliseconds freshness;
+};
+
+/**
+ * A repo followed by addReplica(), by its sync prefix.
+ */
+struct ReplicaPeer {
+  ReplicaPeer()
+  : isOwnedOnly(false)
+  {}
+
+  // size and table of the peer state caught up with, empty until the hello
+  ndn::Name iblt;
+  // followed during a partition handoff, for the prefixes owned here
+  bool isOwnedOnly;
+};
+
+/**
+ * A publication a replica copies from a peer after advancing the prefix.
+ */
+struct ReplicaFetch {
+  ndn::Name peer;
+  std::string prefix;
+  uint32_t seq;
+  int nFailures; // the next peer is asked after a few with one
+};
+
+/**
+ * A tree interest whose node matched, answered once a child changes.
+ */
+struct PendingTreeEntry {
+  std::size_t level;
+  std::size_t index;
   ndn::EventId expirationEvent;
 };
 
+struct RepoMetrics : public Metrics {
+  RepoMetrics();
+
+  Counter& publishes;
+  Counter& publishDrains;
+  Counter& helloInterests;
+  Counter& helloDeltas;
+  Counter& syncInterests;
+  Counter& digestInterests;
+  Counter& digestMisses;
+  Counter& peelComplete;
+  Counter& peelPartial;
+  Counter& peelStalled;
+  Counter& syncReplies;
+  Counter& syncCacheHits;
+  Counter& nacks;
+  Counter& replicaUpdates;     // sequence numbers advanced from a peer
+  Counter& replicaFetches;     // publications copied from a peer
+  Counter& replicaFetchMisses; // publications no peer had, given up on
+  Counter& handoffDrops;       // prefixes removed after moving to another partition
+  Counter& foreignDrops;       // updates refused for prefixes another partition owns
+  Counter& treeInterests;
+  Counter& leafListings;       // tree leaves answered with all their prefixes
+  Histogram& syncProcessingTime; // microseconds per sync or digest interest
+  Histogram& pendingEntries;     // queue depth after each change
+  Histogram& coalescedUpdates;   // distinct prefixes changed per pending pass
+  Histogram& replySize;          // bytes of hello and sync replies
+};
+
 class LogicRepo {
 public:
   LogicRepo(size_t expectedNumEntries, 
@@ -48,14 +226,135 @@ public:
   publishData(const ndn::Block& content, const ndn::time::milliseconds& freshness, 
               std::string prefix);
   
+  /**
+   * publishData() from any thread. The request is queued without locking
+   * and applied on the face thread together with everything else queued
+   * by then, with one pass over the pending interests per batch.
+   */
+  void
+  enqueuePublish(const ndn::Block& content, const ndn::time::milliseconds& freshness,
+                 const std::string& prefix);
+
   void
   updateSeq(std::string prefix, uint32_t seq);
 
+  /**
+   * addSyncNode() and updateSeq() for a whole table of prefixes, e.g. to
+   * bring up a repo with an existing producer population. The keys and
+   * partial IBLTs are built on nThreads threads, 0 for one per core, and
+   * merged, the names are indexed in one pass, and they are served
+   * through one interest filter for their longest common prefix, or one
+   * per first component if they share none. Pending interests are
+   * answered once at the end, digest-based catch-up restarts from the
+   * loaded state. Returns the number of prefixes added
+   * or advanced.
+   */
+  std::size_t
+  bulkLoad(const std::vector<std::pair<std::string, uint32_t> >& table, std::size_t nThreads = 0);
+
+  /**
+   * bulkLoad() from a file of "prefix seq" lines, as in a hello reply.
+   * Returns false if it cannot be read.
+   */
+  bool
+  bulkLoadFile(const std::string& path, std::size_t nThreads = 0);
+
   uint32_t
   getSeq(std::string prefix) {
-    return m_prefixes[prefix];
+    std::lock_guard<std::mutex> lock(m_nameMutex);
+    NameTrie::Id id = m_names.find(prefix);
+    return id == NameTrie::INVALID_ID ? 0 : m_producers[id].seq;
   }
 
+  /**
+   * Decode, diff, peel and sign sync replies on a pool of nThreads
+   * workers, against a snapshot of the IBLT, and put the replies from the
+   * face thread. 0, the default, does everything on the face thread.
+   * Digest interests are always answered on the face thread, replaying
+   * history is cheap next to peeling.
+   *
+   * Published data is then signed in batches on the same pool, and only
+   * served and announced once signed.
+   */
+  void
+  setWorkerThreads(std::size_t nThreads);
+
+  /**
+   * Let changes accumulate before answering the pending interests, so a
+   * burst of updates costs every waiting consumer one reply. The pass runs
+   * once no change arrived for window, and at the latest maxDelay after
+   * the first change it covers. A zero window, the default, answers
+   * after every change.
+   */
+  void
+  setCoalescingWindow(ndn::time::microseconds window, ndn::time::microseconds maxDelay);
+
+  /**
+   * Choose how published data, hello, sync and NACK replies are signed.
+   * The default signs everything with the default identity. Set it before
+   * serving, workers read it without locking.
+   */
+  void
+  setSigningPolicy(const SigningPolicy& policy);
+
+  /**
+   * Number of IBLT changes kept for digest-based catch-up, and of removed
+   * prefixes kept for delta hellos. Consumers whose last-known state is
+   * older fall back to sending the full IBLT or getting the full hello.
+   */
+  void
+  setHistorySize(std::size_t historySize);
+
+  /**
+   * Replicate the repo whose sync prefix is peerPrefix, so that consumers
+   * can be spread over both. This repo follows the peer like a consumer
+   * subscribed to every prefix and takes its sequence numbers, so the two
+   * tables converge and it serves the same hello and sync interests once
+   * caught up. The newest publications of each advanced prefix are copied
+   * best effort, for data interests; those no peer has are given up on. Call it on both sides to replicate both
+   * ways. Removed prefixes are not replicated.
+   */
+  void
+  addReplica(const ndn::Name& peerPrefix);
+
+  /**
+   * Own only the prefixes ring assigns to this repo, by its sync prefix.
+   * For handoffDelay, the partitions of the old and new ring are followed
+   * the way a replica follows a peer, for the prefixes that moved here.
+   * Then the prefixes that moved away are removed along with their
+   * publications, and producers should publish to their new owner.
+   * From this call on, prefixes owned by another partition are refused by
+   * addSyncNode(), updateSeq(), publishData(), bulkLoad() and replication.
+   */
+  void
+  setPartitions(const PartitionRing& ring,
+                ndn::time::milliseconds handoffDelay = ndn::time::milliseconds(5000));
+
+  /**
+   * Also keep the keys in an IBLTTree of fanout^depth leaves, each sized
+   * for leafEntries differences, and answer tree interests on it. A
+   * consumer compares the child digests of a node and descends into the
+   * children that differ, one sync round per level, so neither interests
+   * nor work grow with the group, only with the changed ranges. A leaf
+   * that does not peel is answered with every prefix in its range.
+   * Consumers must use the same shape.
+   */
+  void
+  enableTreeSync(std::size_t fanout, std::size_t depth, std::size_t leafEntries);
+
+  /**
+   * Counters and histograms, plus the current number of IBLT keys and
+   * pending entries.
+   */
+  MetricsSnapshot
+  getMetrics() const;
+
+  /**
+   * Serve getMetrics() as text under <sync-prefix>/status.
+   */
+  void
+  enableStatusDataset();
+
 private:
   void
   onInterest(const ndn::Name& prefix, const ndn::Interest& interest);
@@ -66,28 +365,257 @@ private:
   void
   onSyncInterest(const ndn::Name& prefix, const ndn::Interest& interest);
 
+  void
+  onDigestInterest(const ndn::Name& prefix, const ndn::Interest& interest);
+
+  void
+  onStatusInterest(const ndn::Name& prefix, const ndn::Interest& interest);
+
+  void
+  onTreeInterest(const ndn::Name& prefix, const ndn::Interest& interest);
+
+  void
+  onTreeLeafInterest(const ndn::Name& interestName, const bloom_filter& bf, std::size_t leaf);
+
+  // "DIFF <child>" per child of the node that differs
+  ndn::shared_ptr<ndn::Data>
+  makeTreeData(const ndn::Name& interestName, const std::vector<std::size_t>& children);
+
+  // answer the tree interests whose node changed
+  void
+  satisfyTreeEntries();
+
+  void
+  eraseTreeEntry(const ndn::Name& interestName);
+
+  // publications for replicas, whole in the content
+  void
+  onReplicaDataInterest(const ndn::Name& prefix, const ndn::Interest& interest);
+
   void
   onSyncRegisterFailed(const ndn::Name& prefix, const std::string& msg);
 
+  void
+  sendReplicaHello(const ndn::Name& peer);
+
+  void
+  sendReplicaSync(const ndn::Name& peer);
+
+  void
+  onReplicaHello(const ndn::Name& peer, const ndn::Data& data);
+
+  void
+  onReplicaSync(const ndn::Name& peer, const ndn::Data& data);
+
+  // queue the publications a hello or sync reply of peer announces, only
+  // of the prefixes owned here
+  void
+  addReplicaUpdates(const ndn::Name& peer, const ndn::Block& content);
+
+  bool
+  isOwned(const std::string& prefix) const;
+
+  // stop following for the handoff, remove the prefixes owned elsewhere
+  void
+  finishHandoff();
+
+  // express queued fetches up to the in-flight limit
+  void
+  fetchReplicaData();
+
+  void
+  onReplicaData(const ReplicaFetch& fetch, const ndn::Data& data);
+
+  void
+  onReplicaFetchTimeout(const ReplicaFetch& fetch);
+
+  // queue fetch again, after a delay if isDelayed, from the next peer once
+  // this one failed a few times, or give up once every peer did
+  void
+  retryReplicaFetch(const ReplicaFetch& fetch, bool isDelayed);
+
+  void
+  finishReplicaFetch(const ReplicaFetch& fetch);
+
 private:
+  // The const functions below run on worker threads as well: they read
+  // the state passed in, names under m_nameMutex, and thread-safe metrics.
+
+  // publishData() without answering the pending entries
   void
-  appendIBLT(ndn::Name& name);
+  addPublication(const ndn::Block& content, const ndn::time::milliseconds& freshness,
+                 const std::string& prefix);
 
   void
-  sendNack(const ndn::Interest interest);
+  finishPublish(const ndn::Data& data, const std::string& prefix, uint32_t seq);
 
-  std::size_t
-  getSize(uint64_t varNumber);
+  void
+  drainPublishQueue();
+
+  // filters for the names of a bulk load, for their longest common prefix or
+  // else each first component, unless one covers them already
+  void
+  addLoadFilter(const std::vector<std::pair<std::string, uint32_t> >& table);
+
+  // add prefix with sequence number 0, m_nameMutex held
+  NameTrie::Id
+  addName(const std::string& prefix);
+
+  // move id to the end of the change list at a new name table version
+  void
+  markChanged(NameTrie::Id id);
+
+  void
+  unlinkChange(NameTrie::Id id);
+
+  // key into or out of m_tree and its leaf in m_leafKeys, if tree sync is
+  // enabled, m_nameMutex held
+  void
+  insertTreeKey(IBLT::Key key);
+
+  void
+  eraseTreeKey(IBLT::Key key);
+
+  // prefixes changed after version, false if it has to be a full hello
+  bool
+  appendHelloDelta(ArenaString& content, uint64_t version) const;
+
+  // updateSeq() without answering the pending entries, false if seq is old
+  bool
+  applySeq(const std::string& prefix, uint32_t seq);
+
+  // satisfyPendingEntries() now or at the end of the coalescing window
+  void
+  schedulePendingPass();
+
+  // answer the pending entries after the changes since the last call
+  void
+  satisfyPendingEntries();
+
+  void
+  handleSyncInterest(const ndn::Interest& interest);
+
+  SyncOutcome
+  processSyncInterest(const ndn::Interest& interest, const IBLT& state,
+                      Arena& arena, ndn::KeyChain& keyChain) const;
+
+  void
+  dispatchSyncInterest(const ndn::Interest& interest);
+
+  // null unless an identical interest was handled at the current version
+  const SyncOutcome*
+  findSyncOutcome(const ndn::Name& interestName);
+
+  void
+  cacheSyncOutcome(const ndn::Name& interestName, const SyncOutcome& outcome);
+
+  static uint32_t
+  getSyncInterestDigest(const ndn::Name& interestName);
+
+  SyncOutcome
+  decideSyncReply(const ndn::Interest& interest, const bloom_filter& bf, const IBLT& iblt,
+                  const KeySet& positive, const KeySet& negative, const IBLT& state,
+                  Arena& arena, ndn::KeyChain& keyChain) const;
+
+  void
+  finishSyncInterest(const ndn::Interest& interest, const SyncOutcome& outcome);
+
+  // reply for a pending entry after a change, or null to keep waiting
+  ndn::shared_ptr<ndn::Data>
+  processPendingEntry(const ndn::Name& interestName, const bloom_filter& bf,
+                      const IBLT& iblt, const IBLT& state, uint32_t& diffBound,
+                      Arena& arena, ndn::KeyChain& keyChain) const;
+
+  void
+  dispatchPendingEntry(const ndn::Name& interestName, const PendingEntryInfo& entry);
+
+  std::shared_ptr<const RepoSnapshot>
+  getSnapshot();
+
+  // whether the filter at index has a hash this build has, a count, an
+  // fp*1000 in 1..999 and a table of the size they make, before decodeBF()
+  static bool
+  hasValidBF(const ndn::Name& interestName, std::size_t index);
+
+  bloom_filter
+  decodeBF(const ndn::Name& interestName, std::size_t index, Arena& arena) const;
+
+  void
+  recordHistory(bool hasRemoved, IBLT::Key removed, bool hasAdded, IBLT::Key added);
+
+  void
+  appendIBLT(ndn::Name& name, const IBLT& iblt, Arena& arena) const;
+
+  ArenaString
+  getSyncContent(const KeySet& positive, const bloom_filter& bf, Arena& arena) const;
+
+  // every subscribed prefix whose key is in a leaf of m_tree
+  ArenaString
+  getLeafContent(std::size_t leaf, const bloom_filter& bf, Arena& arena) const;
+
+  // "name seq" of id if bf contains it, m_nameMutex held
+  void
+  appendIfSubscribed(ArenaString& content, NameTrie::Id id, const bloom_filter& bf,
+                     Arena& arena) const;
+
+  ndn::shared_ptr<ndn::Data>
+  makeSyncData(const ndn::Name& interestName, const IBLT& iblt, const ArenaString& content,
+               Arena& arena, ndn::KeyChain& keyChain) const;
+
+  // the recovered part of a difference that stopped peeling
+  ndn::shared_ptr<ndn::Data>
+  makePartial(const ndn::Name& interestName, const IBLT& iblt, const bloom_filter& bf,
+              const KeySet& positive, const KeySet& negative,
+              Arena& arena, ndn::KeyChain& keyChain) const;
+
+  ndn::shared_ptr<ndn::Data>
+  makeNack(const ndn::Name& interestName, ndn::KeyChain& keyChain) const;
+
+  void
+  erasePendingEntry(const ndn::Name& interestName);
+
+  void
+  recordPeel(bool isComplete, std::size_t nPeeled) const;
 
 private:
   IBLT m_iblt;
   uint32_t m_expectedNumEntries;
   uint32_t m_threshold;
 
-  std::map <std::string, uint32_t> m_prefixes; // prefix and sequence number
-  std::map <std::string, uint32_t> m_prefix2hash;
-  std::map <uint32_t, std::string> m_hash2prefix;
+  NameTrie m_names; // producer prefixes
+  std::vector <ProducerState> m_producers; // by name id
+  std::unordered_map <IBLT::Key, NameTrie::Id> m_hash2id;
+  // Name table versions for delta hellos, bumped on every add, advance or
+  // removal of a prefix. The epoch tells versions of another run apart.
+  uint64_t m_namesEpoch;
+  uint64_t m_namesVersion;
+  NameTrie::Id m_firstChange; // least recently changed producer
+  NameTrie::Id m_lastChange;
+  std::deque <RemovedName> m_removedNames;
+  uint64_t m_deltaHorizon; // removals up to this version are forgotten
   std::map <ndn::Name, PendingEntryInfo> m_pendingEntries;
+  std::vector <std::string> m_changedPrefixes; // applied since the last pending pass
+  ndn::time::microseconds m_coalescingWindow;
+  ndn::time::microseconds m_coalescingMaxDelay;
+  bool m_isPassScheduled;
+  ndn::time::steady_clock::TimePoint m_passDeadline; // first change + max delay
+  ndn::EventId m_passEvent;
+  // digest of the interest's BF and IBLT components, for m_syncCacheVersion
+  std::unordered_map <uint32_t, CachedSyncOutcome> m_syncCache;
+  uint64_t m_syncCacheVersion;
+
+  std::deque <HistoryEntry> m_history;
+  std::unordered_map <uint64_t, uint64_t> m_digest2history; // digest, history position
+  uint64_t m_historyStart; // position of m_history.front()
+  std::size_t m_historySize;
+  uint64_t m_version; // bumped on every change to m_iblt
+  std::shared_ptr<const RepoSnapshot> m_snapshot;
+  // guards m_names, m_producers and m_hash2id, written only on the face thread
+  mutable std::mutex m_nameMutex;
+  SubscriptionFilter m_subscriptions; // union of the pending entries' BFs
+  // most consumers share a few subscriptions and states
+  InternPool<bloom_filter, PendingStateHash> m_bfPool;
+  InternPool<IBLT, PendingStateHash> m_ibltPool;
 
   ndn::Face& m_face;
   ndn::Name m_syncPrefix;
@@ -99,6 +627,31 @@ private:
   ndn::time::milliseconds m_syncReplyFreshness;
 
   ndn::util::InMemoryStoragePersistent m_ims;
+
+  RepoMetrics m_metrics;
+
+  // temporaries of the interest or publish being handled, rewound after each
+  Arena m_arena;
+
+  SigningPolicy m_signingPolicy;
+
+  MpscQueue<PublishRequest> m_publishQueue;
+  std::atomic<bool> m_isDrainScheduled;
+
+  std::shared_ptr<bool> m_alive; // expires with the repo, for posted replies
+
+  std::map <ndn::Name, ReplicaPeer> m_replicas;
+  std::deque <ReplicaFetch> m_replicaFetchQueue;
+  std::set <ndn::Name> m_replicaFetchNames; // publications queued or in flight
+  std::size_t m_nReplicaFetching;
+  PartitionRing m_ring; // empty unless partitioned
+  uint64_t m_handoffCount; // setPartitions() calls, the last one's handoff finishes
+  std::unique_ptr<IBLTTree> m_tree; // null unless tree sync is enabled
+  std::vector <std::vector <IBLT::Key>> m_leafKeys; // keys by leaf of m_tree, unordered
+  std::map <ndn::Name, PendingTreeEntry> m_pendingTreeEntries;
+  std::vector <ndn::Name> m_loadFilters; // registered by bulkLoad()
+  std::unique_ptr<ThreadPool> m_workers;
+  std::unique_ptr<BatchSigner> m_publishSigner;
 };
 
 }
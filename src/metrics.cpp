@@ -0,0 +1,134 @@
+#include <sstream>
+
+#include "metrics.hpp"
+
+namespace psync {
+
+const unsigned Histogram::SUB_BITS;
+const size_t Histogram::N_BUCKETS;
+
+uint64_t
+HistogramSnapshot::percentile(double p) const
+{
+  if (count == 0)
+    return 0;
+
+  uint64_t rank = static_cast<uint64_t>(p * count);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      // middle of the bucket, but never beyond the largest value seen
+      uint64_t start = Histogram::bucketStart(i);
+      uint64_t end = i + 1 < Histogram::N_BUCKETS ? Histogram::bucketStart(i + 1) : start;
+      uint64_t mid = start + (end - start)/2;
+      return mid < max ? mid : max;
+    }
+  }
+  return max;
+}
+
+Histogram::Histogram()
+: m_count(0)
+, m_sum(0)
+, m_max(0)
+{
+  for (size_t i = 0; i < N_BUCKETS; i++) {
+    m_buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+size_t
+Histogram::bucketOf(uint64_t value)
+{
+  if (value < (1u << SUB_BITS))
+    return value;
+
+  unsigned msb = 63 - __builtin_clzll(value);
+  unsigned shift = msb - SUB_BITS;
+  return ((shift + 1) << SUB_BITS) + ((value >> shift) & ((1u << SUB_BITS) - 1));
+}
+
+uint64_t
+Histogram::bucketStart(size_t bucket)
+{
+  if (bucket < (1u << SUB_BITS))
+    return bucket;
+
+  unsigned shift = (bucket >> SUB_BITS) - 1;
+  return static_cast<uint64_t>((1u << SUB_BITS) + (bucket & ((1u << SUB_BITS) - 1))) << shift;
+}
+
+void
+Histogram::record(uint64_t value)
+{
+  m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t max = m_max.load(std::memory_order_relaxed);
+  while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+HistogramSnapshot
+Histogram::snapshot() const
+{
+  HistogramSnapshot snapshot;
+  snapshot.buckets.resize(N_BUCKETS);
+  for (size_t i = 0; i < N_BUCKETS; i++) {
+    snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.buckets[i];
+  }
+  snapshot.sum = m_sum.load(std::memory_order_relaxed);
+  snapshot.max = m_max.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+std::string
+MetricsSnapshot::toString() const
+{
+  std::ostringstream os;
+  for (auto& c : counters) {
+    os << c.first << " " << c.second << "\n";
+  }
+  for (auto& h : histograms) {
+    os << h.first << " count " << h.second.count << " sum " << h.second.sum
+       << " p50 " << h.second.percentile(0.5) << " p90 " << h.second.percentile(0.9)
+       << " p99 " << h.second.percentile(0.99) << " max " << h.second.max << "\n";
+  }
+  return os.str();
+}
+
+MetricsSnapshot
+Metrics::snapshot() const
+{
+  MetricsSnapshot snapshot;
+  for (auto& c : m_counters) {
+    snapshot.counters[c.first] = c.second->get();
+  }
+  for (auto& h : m_histograms) {
+    snapshot.histograms[h.first] = h.second->snapshot();
+  }
+  return snapshot;
+}
+
+Counter&
+Metrics::counter(const std::string& name)
+{
+  std::unique_ptr<Counter>& c = m_counters[name];
+  if (!c)
+    c.reset(new Counter);
+  return *c;
+}
+
+Histogram&
+Metrics::histogram(const std::string& name)
+{
+  std::unique_ptr<Histogram>& h = m_histograms[name];
+  if (!h)
+    h.reset(new Histogram);
+  return *h;
+}
+
+}
@@ -0,0 +1,148 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <inttypes.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace psync {
+
+class Counter
+{
+public:
+  Counter()
+  : m_value(0)
+  {}
+
+  void
+  increment(uint64_t n = 1)
+  {
+    m_value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t
+  get() const
+  {
+    return m_value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> m_value;
+};
+
+struct HistogramSnapshot
+{
+  HistogramSnapshot()
+  : count(0)
+  , sum(0)
+  , max(0)
+  {}
+
+  uint64_t
+  percentile(double p) const;
+
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  std::vector <uint64_t> buckets;
+};
+
+/**
+ * Log-linear histogram of non-negative integers (HDR style): each power
+ * of two is split into 2^SUB_BITS buckets, so recorded values keep about
+ * 12% relative precision. Recording is a few relaxed atomic operations.
+ */
+class Histogram
+{
+public:
+  static const unsigned SUB_BITS = 3;
+  static const size_t N_BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+  Histogram();
+
+  void
+  record(uint64_t value);
+
+  HistogramSnapshot
+  snapshot() const;
+
+  static size_t
+  bucketOf(uint64_t value);
+
+  // smallest value falling into the bucket
+  static uint64_t
+  bucketStart(size_t bucket);
+
+private:
+  std::atomic<uint64_t> m_buckets[N_BUCKETS];
+  std::atomic<uint64_t> m_count;
+  std::atomic<uint64_t> m_sum;
+  std::atomic<uint64_t> m_max;
+};
+
+/**
+ * Records the microseconds between construction and destruction.
+ */
+class ScopedTimer
+{
+public:
+  explicit
+  ScopedTimer(Histogram& histogram)
+  : m_histogram(histogram)
+  , m_start(std::chrono::steady_clock::now())
+  {}
+
+  ~ScopedTimer()
+  {
+    m_histogram.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - m_start).count());
+  }
+
+private:
+  Histogram& m_histogram;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+struct MetricsSnapshot
+{
+  // one "name value" line per counter and one line with count, sum,
+  // percentiles and max per histogram
+  std::string
+  toString() const;
+
+  std::map <std::string, uint64_t> counters;
+  std::map <std::string, HistogramSnapshot> histograms;
+};
+
+/**
+ * Named counters and histograms. They are registered up front, typically
+ * by a subclass binding them to reference members, and are then updated
+ * without locks from any thread.
+ */
+class Metrics
+{
+public:
+  virtual ~Metrics() {}
+
+  MetricsSnapshot
+  snapshot() const;
+
+protected:
+  Counter&
+  counter(const std::string& name);
+
+  Histogram&
+  histogram(const std::string& name);
+
+private:
+  std::map <std::string, std::unique_ptr<Counter> > m_counters;
+  std::map <std::string, std::unique_ptr<Histogram> > m_histograms;
+};
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+namespace psync {
+
+/**
+ * Unbounded multi-producer single-consumer queue (Vyukov's intrusive
+ * design). push() is one atomic exchange and never blocks; pop() must
+ * only be called from one thread at a time.
+ *
+ * An element whose push() is still in progress can hide the elements
+ * pushed after it until that push() returns, so the consumer must be
+ * woken after push() returns, not before.
+ */
+template<typename T>
+class MpscQueue
+{
+public:
+  MpscQueue()
+  : m_head(new Node)
+  , m_tail(m_head.load())
+  {
+  }
+
+  ~MpscQueue()
+  {
+    T value;
+    while (pop(value)) {
+    }
+    delete m_tail;
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  void
+  push(T value)
+  {
+    Node* node = new Node(std::move(value));
+    Node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  bool
+  pop(T& value)
+  {
+    Node* next = m_tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+
+    // next becomes the new stub, its value moves out
+    value = std::move(next->value);
+    delete m_tail;
+    m_tail = next;
+    return true;
+  }
+
+private:
+  struct Node
+  {
+    Node()
+    : next(nullptr)
+    {}
+
+    explicit Node(T&& value)
+    : next(nullptr)
+    , value(std::move(value))
+    {}
+
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  std::atomic<Node*> m_head; // last pushed, producers
+  Node* m_tail;              // stub before the first element, consumer
+};
+
+}
+
+#endif
@@ -9,17 +9,22 @@ uint32_t ROTL32 ( uint32_t x, int8_t r )
 }
 
 uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+  return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
+
+uint32_t MurmurHash3(uint32_t nHashSeed, const uint8_t* data, size_t len)
 {
   // The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
   uint32_t h1 = nHashSeed;
   const uint32_t c1 = 0xcc9e2d51;
   const uint32_t c2 = 0x1b873593;
 
-  const size_t nblocks = vDataToHash.size() / 4;
+  const size_t nblocks = len / 4;
 
   //----------
   // body
-  const uint32_t * blocks = (const uint32_t *)(&vDataToHash[0] + nblocks*4);
+  const uint32_t * blocks = (const uint32_t *)(data + nblocks*4);
 
   for (size_t i = -nblocks; i; i++) {
     uint32_t k1 = blocks[i];
@@ -35,11 +40,11 @@ uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vData
 
   //----------
   // tail
-  const uint8_t * tail = (const uint8_t*)(&vDataToHash[0] + nblocks*4);
+  const uint8_t * tail = (const uint8_t*)(data + nblocks*4);
 
   uint32_t k1 = 0;
 
-  switch(vDataToHash.size() & 3) {
+  switch(len & 3) {
     case 3: k1 ^= tail[2] << 16;
     case 2: k1 ^= tail[1] << 8;
     case 1: k1 ^= tail[0];
@@ -48,7 +53,7 @@ uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vData
 
   //----------
   // finalization
-  h1 ^= vDataToHash.size();
+  h1 ^= len;
   h1 ^= h1 >> 16;
   h1 *= 0x85ebca6b;
   h1 ^= h1 >> 13;
@@ -2,12 +2,15 @@
 #define MURMURHASH3_HPP
 
 #include <inttypes.h>
+#include <cstddef>
 #include <vector>
 
 namespace psync {
 
 uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+uint32_t MurmurHash3(uint32_t nHashSeed, const uint8_t* data, size_t len);
+
 }
 
 #endif
@@ -0,0 +1,257 @@
+#include "name_trie.hpp"
+
+#include <limits>
+
+namespace psync {
+
+const NameTrie::Id NameTrie::INVALID_ID = std::numeric_limits<NameTrie::Id>::max();
+const NameTrie::Index NameTrie::INVALID_INDEX = std::numeric_limits<NameTrie::Index>::max();
+const NameTrie::Index NameTrie::ROOT;
+
+// label bytes dropped by erase() before they are reclaimed
+static const std::size_t MIN_GARBAGE = 4096;
+
+NameTrie::NameTrie()
+: m_garbage(0)
+, m_size(0)
+{
+  Node root;
+  root.parent = ROOT;
+  root.firstChild = INVALID_INDEX;
+  root.nextSibling = INVALID_INDEX;
+  root.labelOffset = 0;
+  root.labelSize = 0;
+  root.id = INVALID_ID;
+  m_nodes.push_back(root);
+}
+
+std::pair<NameTrie::Id, bool>
+NameTrie::insert(const std::string& name)
+{
+  Index n = ROOT;
+  std::size_t pos = 0;
+  while (pos < name.size()) {
+    Index child = findChild(n, name[pos]);
+    if (child == INVALID_INDEX) {
+      uint32_t offset = m_labels.size();
+      m_labels.append(name, pos, std::string::npos);
+      child = newNode(n, offset, name.size() - pos);
+      linkChild(n, child);
+      return std::make_pair(assignId(child), true);
+    }
+
+    const Node& node = m_nodes[child];
+    uint32_t common = 0;
+    while (common < node.labelSize && pos + common < name.size() &&
+           label(node)[common] == name[pos + common]) {
+      ++common;
+    }
+    if (common < node.labelSize) {
+      child = split(child, common);
+    }
+    n = child;
+    pos += common;
+  }
+
+  if (m_nodes[n].id != INVALID_ID) {
+    return std::make_pair(m_nodes[n].id, false);
+  }
+  return std::make_pair(assignId(n), true);
+}
+
+NameTrie::Id
+NameTrie::find(const std::string& name) const
+{
+  Index n = ROOT;
+  std::size_t pos = 0;
+  while (pos < name.size()) {
+    n = findChild(n, name[pos]);
+    if (n == INVALID_INDEX)
+      return INVALID_ID;
+
+    const Node& node = m_nodes[n];
+    if (name.size() - pos < node.labelSize ||
+        name.compare(pos, node.labelSize, label(node), node.labelSize) != 0)
+      return INVALID_ID;
+    pos += node.labelSize;
+  }
+  return m_nodes[n].id;
+}
+
+bool
+NameTrie::erase(Id id)
+{
+  if (id >= m_idNodes.size() || m_idNodes[id] == INVALID_INDEX) {
+    return false;
+  }
+
+  Index n = m_idNodes[id];
+  m_nodes[n].id = INVALID_ID;
+  m_idNodes[id] = INVALID_INDEX;
+  m_freeIds.push_back(id);
+  --m_size;
+
+  // drop the branch that no longer leads to a name
+  while (n != ROOT && m_nodes[n].id == INVALID_ID && m_nodes[n].firstChild == INVALID_INDEX) {
+    Index parent = m_nodes[n].parent;
+    unlinkChild(parent, n);
+    freeNode(n);
+    n = parent;
+  }
+
+  // merge a pass-through node into its only child, which keeps its index
+  // and so its id
+  const Node& node = m_nodes[n];
+  if (n != ROOT && node.id == INVALID_ID && m_nodes[node.firstChild].nextSibling == INVALID_INDEX) {
+    Index parent = node.parent;
+    Index child = node.firstChild;
+    uint32_t offset = m_labels.size();
+    m_labels.append(label(node), node.labelSize);
+    m_labels.append(label(m_nodes[child]), m_nodes[child].labelSize);
+    m_garbage += m_nodes[child].labelSize;
+
+    unlinkChild(parent, n);
+    freeNode(n);
+    m_nodes[child].parent = parent;
+    m_nodes[child].labelOffset = offset;
+    m_nodes[child].labelSize = m_labels.size() - offset;
+    linkChild(parent, child);
+  }
+
+  if (m_garbage > MIN_GARBAGE && m_garbage > m_labels.size() / 2) {
+    compactLabels();
+  }
+  return true;
+}
+
+std::size_t
+NameTrie::memoryUsage() const
+{
+  return sizeof(*this) +
+         m_nodes.capacity() * sizeof(Node) +
+         m_freeNodes.capacity() * sizeof(Index) +
+         m_labels.capacity() +
+         m_idNodes.capacity() * sizeof(Index) +
+         m_freeIds.capacity() * sizeof(Id);
+}
+
+NameTrie::Index
+NameTrie::findChild(Index parent, char first) const
+{
+  unsigned char byte = first;
+  for (Index n = m_nodes[parent].firstChild; n != INVALID_INDEX; n = m_nodes[n].nextSibling) {
+    unsigned char childByte = *label(m_nodes[n]);
+    if (childByte == byte)
+      return n;
+    if (childByte > byte)
+      break;
+  }
+  return INVALID_INDEX;
+}
+
+void
+NameTrie::linkChild(Index parent, Index child)
+{
+  unsigned char byte = *label(m_nodes[child]);
+  Index* link = &m_nodes[parent].firstChild;
+  while (*link != INVALID_INDEX && static_cast<unsigned char>(*label(m_nodes[*link])) < byte) {
+    link = &m_nodes[*link].nextSibling;
+  }
+  m_nodes[child].nextSibling = *link;
+  *link = child;
+}
+
+void
+NameTrie::unlinkChild(Index parent, Index child)
+{
+  Index* link = &m_nodes[parent].firstChild;
+  while (*link != child) {
+    link = &m_nodes[*link].nextSibling;
+  }
+  *link = m_nodes[child].nextSibling;
+  m_nodes[child].nextSibling = INVALID_INDEX;
+}
+
+NameTrie::Index
+NameTrie::newNode(Index parent, uint32_t labelOffset, uint32_t labelSize)
+{
+  Node node;
+  node.parent = parent;
+  node.firstChild = INVALID_INDEX;
+  node.nextSibling = INVALID_INDEX;
+  node.labelOffset = labelOffset;
+  node.labelSize = labelSize;
+  node.id = INVALID_ID;
+
+  if (!m_freeNodes.empty()) {
+    Index index = m_freeNodes.back();
+    m_freeNodes.pop_back();
+    m_nodes[index] = node;
+    return index;
+  }
+  m_nodes.push_back(node);
+  return m_nodes.size() - 1;
+}
+
+void
+NameTrie::freeNode(Index index)
+{
+  m_garbage += m_nodes[index].labelSize;
+  m_nodes[index].parent = INVALID_INDEX;
+  m_nodes[index].labelSize = 0;
+  m_freeNodes.push_back(index);
+}
+
+NameTrie::Index
+NameTrie::split(Index index, uint32_t length)
+{
+  // the upper half takes the place of the node among its siblings, the
+  // node keeps its index, and the label bytes are shared, not copied
+  Index parent = m_nodes[index].parent;
+  Index upper = newNode(parent, m_nodes[index].labelOffset, length);
+  unlinkChild(parent, index);
+  linkChild(parent, upper);
+
+  Node& node = m_nodes[index];
+  node.parent = upper;
+  node.labelOffset += length;
+  node.labelSize -= length;
+  m_nodes[upper].firstChild = index;
+  return upper;
+}
+
+NameTrie::Id
+NameTrie::assignId(Index index)
+{
+  Id id;
+  if (!m_freeIds.empty()) {
+    id = m_freeIds.back();
+    m_freeIds.pop_back();
+    m_idNodes[id] = index;
+  }
+  else {
+    id = m_idNodes.size();
+    m_idNodes.push_back(index);
+  }
+  m_nodes[index].id = id;
+  ++m_size;
+  return id;
+}
+
+void
+NameTrie::compactLabels()
+{
+  std::string labels;
+  labels.reserve(m_labels.size() - m_garbage);
+  for (Node& node : m_nodes) {
+    if (node.labelSize == 0)
+      continue;
+    uint32_t offset = labels.size();
+    labels.append(label(node), node.labelSize);
+    node.labelOffset = offset;
+  }
+  m_labels.swap(labels);
+  m_garbage = 0;
+}
+
+}
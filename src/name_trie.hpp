@@ -0,0 +1,229 @@
+#ifndef NAME_TRIE_HPP
+#define NAME_TRIE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+namespace psync {
+
+/**
+ * Compressed radix trie of names, e.g. producer prefixes. Names sharing
+ * a root such as /org/site/building/room/ store it once, and each name
+ * gets a small id, stable for as long as the name is in the trie, for
+ * per-name tables kept next to it.
+ *
+ * Iteration is in lexicographic order. Names are plain byte strings, so
+ * a subtree query for "/a/b" also visits "/a/bc"; pass "/a/b/" to stop
+ * at component boundaries.
+ */
+class NameTrie
+{
+public:
+  typedef uint32_t Id;
+
+  static const Id INVALID_ID;
+
+  NameTrie();
+
+  /**
+   * Id of name, and whether it was added by this call.
+   */
+  std::pair<Id, bool>
+  insert(const std::string& name);
+
+  // INVALID_ID if name is not in the trie
+  Id
+  find(const std::string& name) const;
+
+  // false if id is not in use; the id is reused by a later insert
+  bool
+  erase(Id id);
+
+  std::string
+  getName(Id id) const
+  {
+    std::string name;
+    appendName(id, name);
+    return name;
+  }
+
+  // append the name of id to any string type, e.g. an ArenaString
+  template<typename String>
+  void
+  appendName(Id id, String& out) const;
+
+  // number of names
+  std::size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  // upper bound of the ids in use, for sizing per-id tables
+  Id
+  idBound() const
+  {
+    return m_idNodes.size();
+  }
+
+  // bytes held by the trie
+  std::size_t
+  memoryUsage() const;
+
+  /**
+   * Call f(id, name) for every name, in lexicographic order. name is a
+   * buffer reused between calls.
+   */
+  template<typename F>
+  void
+  forEach(F f) const
+  {
+    forEachUnder("", f);
+  }
+
+  // forEach() over the names starting with prefix
+  template<typename F>
+  void
+  forEachUnder(const std::string& prefix, F f) const;
+
+private:
+  typedef uint32_t Index; // of m_nodes
+
+  struct Node
+  {
+    Index parent;      // INVALID_INDEX while on the free list
+    Index firstChild;  // children are sorted by the first byte of their label
+    Index nextSibling;
+    uint32_t labelOffset; // into m_labels, the part of the name below parent
+    uint32_t labelSize;
+    Id id;             // INVALID_ID unless a name ends here
+  };
+
+  static const Index ROOT = 0;
+  static const Index INVALID_INDEX;
+
+  const char*
+  label(const Node& node) const
+  {
+    return m_labels.data() + node.labelOffset;
+  }
+
+  Index
+  findChild(Index parent, char first) const;
+
+  void
+  linkChild(Index parent, Index child);
+
+  void
+  unlinkChild(Index parent, Index child);
+
+  Index
+  newNode(Index parent, uint32_t labelOffset, uint32_t labelSize);
+
+  void
+  freeNode(Index index);
+
+  // split node after length bytes of its label, return the upper half
+  Index
+  split(Index index, uint32_t length);
+
+  Id
+  assignId(Index index);
+
+  void
+  compactLabels();
+
+private:
+  std::vector <Node> m_nodes;
+  std::vector <Index> m_freeNodes;
+  std::string m_labels;          // label bytes of all nodes
+  std::size_t m_garbage;         // label bytes no node refers to
+  std::vector <Index> m_idNodes; // node of each id, INVALID_INDEX if free
+  std::vector <Id> m_freeIds;
+  std::size_t m_size;
+};
+
+template<typename String>
+void
+NameTrie::appendName(Id id, String& out) const
+{
+  std::size_t length = 0;
+  for (Index n = m_idNodes[id]; n != ROOT; n = m_nodes[n].parent) {
+    length += m_nodes[n].labelSize;
+  }
+
+  // labels are found leaf first, fill from the back
+  std::size_t end = out.size() + length;
+  out.resize(end);
+  for (Index n = m_idNodes[id]; n != ROOT; n = m_nodes[n].parent) {
+    const Node& node = m_nodes[n];
+    end -= node.labelSize;
+    std::copy(label(node), label(node) + node.labelSize, &out[end]);
+  }
+}
+
+template<typename F>
+void
+NameTrie::forEachUnder(const std::string& prefix, F f) const
+{
+  // find the topmost node whose name starts with prefix
+  Index start = ROOT;
+  std::string name;
+  std::size_t pos = 0;
+  while (pos < prefix.size()) {
+    Index child = findChild(start, prefix[pos]);
+    if (child == INVALID_INDEX)
+      return;
+
+    const Node& node = m_nodes[child];
+    std::size_t common = 0;
+    while (common < node.labelSize && pos + common < prefix.size() &&
+           label(node)[common] == prefix[pos + common]) {
+      ++common;
+    }
+    if (pos + common < prefix.size() && common < node.labelSize)
+      return;
+
+    name.append(label(node), node.labelSize);
+    pos += common;
+    start = child;
+  }
+
+  if (m_nodes[start].id != INVALID_ID) {
+    f(m_nodes[start].id, static_cast<const std::string&>(name));
+  }
+
+  // pre-order walk over parent links, name holds the path to n
+  Index n = m_nodes[start].firstChild;
+  while (n != INVALID_INDEX) {
+    const Node& node = m_nodes[n];
+    name.append(label(node), node.labelSize);
+    if (node.id != INVALID_ID) {
+      f(node.id, static_cast<const std::string&>(name));
+    }
+    if (node.firstChild != INVALID_INDEX) {
+      n = node.firstChild;
+      continue;
+    }
+
+    while (true) {
+      name.resize(name.size() - m_nodes[n].labelSize);
+      if (m_nodes[n].nextSibling != INVALID_INDEX) {
+        n = m_nodes[n].nextSibling;
+        break;
+      }
+      n = m_nodes[n].parent;
+      if (n == start) {
+        n = INVALID_INDEX;
+        break;
+      }
+    }
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include "partition_ring.hpp"
+#include "murmurhash3.hpp"
+
+#include <algorithm>
+
+namespace psync {
+
+const std::size_t PartitionRing::DEFAULT_VIRTUAL_NODES = 128;
+
+// prefixes are hashed with a seed no virtual node uses
+static const uint32_t PREFIX_SEED = 0xffffffff;
+
+PartitionRing::PartitionRing(std::size_t nVirtual)
+: m_nVirtual(std::max<std::size_t>(nVirtual, 1))
+{
+}
+
+void
+PartitionRing::addPartition(const std::string& partition)
+{
+  auto it = std::lower_bound(m_partitions.begin(), m_partitions.end(), partition);
+  if (it != m_partitions.end() && *it == partition) {
+    return;
+  }
+  m_partitions.insert(it, partition);
+  buildRing();
+}
+
+void
+PartitionRing::removePartition(const std::string& partition)
+{
+  auto it = std::lower_bound(m_partitions.begin(), m_partitions.end(), partition);
+  if (it == m_partitions.end() || *it != partition) {
+    return;
+  }
+  m_partitions.erase(it);
+  buildRing();
+}
+
+const std::string&
+PartitionRing::getPartition(const std::string& prefix) const
+{
+  static const std::string none;
+  if (m_points.empty()) {
+    return none;
+  }
+
+  uint32_t hash = MurmurHash3(PREFIX_SEED, reinterpret_cast<const uint8_t*>(prefix.data()),
+                              prefix.size());
+  auto it = m_points.lower_bound(hash);
+  if (it == m_points.end()) {
+    it = m_points.begin();
+  }
+  return m_partitions[it->second];
+}
+
+bool
+PartitionRing::hasPartition(const std::string& partition) const
+{
+  return std::binary_search(m_partitions.begin(), m_partitions.end(), partition);
+}
+
+void
+PartitionRing::buildRing()
+{
+  // Rebuilt from the sorted partitions, so a point two partitions hash to
+  // goes to the same one everywhere: the first in order, which claims it
+  // first. Membership changes are rare next to lookups.
+  m_points.clear();
+  for (std::size_t i = 0; i < m_partitions.size(); i++) {
+    const std::string& partition = m_partitions[i];
+    for (std::size_t v = 0; v < m_nVirtual; v++) {
+      uint32_t point = MurmurHash3(v, reinterpret_cast<const uint8_t*>(partition.data()),
+                                   partition.size());
+      m_points.insert(std::make_pair(point, i));
+    }
+  }
+}
+
+}
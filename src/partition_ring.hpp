@@ -0,0 +1,68 @@
+#ifndef PARTITION_RING_HPP
+#define PARTITION_RING_HPP
+
+#include <cstddef>
+#include <inttypes.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace psync {
+
+/**
+ * Consistent hashing of producer prefixes onto repo partitions, each
+ * named by the sync prefix of its repo.
+ *
+ * Every partition owns nVirtual points on a 32-bit ring, and a prefix
+ * belongs to the first point at or after its hash. Adding or removing
+ * one of n partitions moves about 1/n of the prefixes, and only to or
+ * from that partition. Repos and consumers holding the same partitions
+ * agree on every owner, whatever order the partitions were added in.
+ */
+class PartitionRing
+{
+public:
+  static const std::size_t DEFAULT_VIRTUAL_NODES;
+
+  explicit
+  PartitionRing(std::size_t nVirtual = DEFAULT_VIRTUAL_NODES);
+
+  void
+  addPartition(const std::string& partition);
+
+  void
+  removePartition(const std::string& partition);
+
+  // owner of prefix, empty if there are no partitions
+  const std::string&
+  getPartition(const std::string& prefix) const;
+
+  bool
+  hasPartition(const std::string& partition) const;
+
+  // in lexicographic order
+  const std::vector <std::string>&
+  getPartitions() const
+  {
+    return m_partitions;
+  }
+
+  bool
+  empty() const
+  {
+    return m_partitions.empty();
+  }
+
+private:
+  void
+  buildRing();
+
+private:
+  std::size_t m_nVirtual;
+  std::vector <std::string> m_partitions;
+  std::map <uint32_t, std::size_t> m_points; // index into m_partitions
+};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <ndn-cxx/encoding/encoding-buffer.hpp>
+#include <ndn-cxx/security/signing-helpers.hpp>
+#include <ndn-cxx/util/digest.hpp>
+
+#include "signing_policy.hpp"
+
+namespace psync {
+
+// signature type from the NDN packet format, not named by every ndn-cxx release
+static const int SIGNATURE_HMAC_WITH_SHA256 = 4;
+
+static const std::size_t SHA256_BLOCK_SIZE = 64;
+
+SigningPolicy::SigningPolicy()
+{
+  for (auto& rule : m_rules) {
+    rule.method = SIGN_IDENTITY;
+  }
+}
+
+void
+SigningPolicy::setMethod(PacketClass packetClass, Method method, const ndn::Name& identity)
+{
+  if (method == SIGN_HMAC_SHA256 && m_hmacKey.empty()) {
+    throw std::invalid_argument("HMAC signing needs a key, call setHmacKey first");
+  }
+
+  m_rules[packetClass].method = method;
+  m_rules[packetClass].identity = identity;
+}
+
+void
+SigningPolicy::setHmacKey(const ndn::Name& keyName, const std::vector<uint8_t>& key)
+{
+  m_hmacKeyName = keyName;
+  m_hmacKey = key;
+}
+
+void
+SigningPolicy::sign(ndn::Data& data, PacketClass packetClass, ndn::KeyChain& keyChain) const
+{
+  const Rule& rule = m_rules[packetClass];
+  switch (rule.method) {
+    case SIGN_DIGEST_SHA256:
+      keyChain.sign(data, ndn::security::signingWithSha256());
+      break;
+    case SIGN_HMAC_SHA256:
+      signHmac(data);
+      break;
+    case SIGN_IDENTITY:
+    default:
+      if (rule.identity.empty())
+        keyChain.sign(data);
+      else
+        keyChain.sign(data, ndn::security::signingByIdentity(rule.identity));
+      break;
+  }
+}
+
+void
+SigningPolicy::signHmac(ndn::Data& data) const
+{
+  ndn::SignatureInfo info(static_cast<ndn::tlv::SignatureTypeValue>(SIGNATURE_HMAC_WITH_SHA256),
+                          ndn::KeyLocator(m_hmacKeyName));
+  data.setSignature(ndn::Signature(info));
+
+  // same steps as KeyChain: encode the signed portion, then add the value
+  ndn::EncodingBuffer encoder;
+  data.wireEncode(encoder, true);
+  ndn::ConstBufferPtr mac = hmacSha256(m_hmacKey.data(), m_hmacKey.size(),
+                                       encoder.buf(), encoder.size());
+  data.wireEncode(encoder, ndn::Block(ndn::tlv::SignatureValue, mac));
+}
+
+ndn::KeyChain&
+SigningPolicy::threadKeyChain()
+{
+  static thread_local ndn::KeyChain keyChain;
+  return keyChain;
+}
+
+ndn::ConstBufferPtr
+hmacSha256(const uint8_t* key, std::size_t keyLength, const uint8_t* data, std::size_t length)
+{
+  uint8_t block[SHA256_BLOCK_SIZE] = {0};
+  if (keyLength > SHA256_BLOCK_SIZE) {
+    ndn::util::Sha256 keyDigest;
+    keyDigest.update(key, keyLength);
+    ndn::ConstBufferPtr digest = keyDigest.computeDigest();
+    memcpy(block, digest->buf(), digest->size());
+  }
+  else {
+    memcpy(block, key, keyLength);
+  }
+
+  uint8_t pad[SHA256_BLOCK_SIZE];
+  for (std::size_t i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = block[i] ^ 0x36;
+  }
+  ndn::util::Sha256 inner;
+  inner.update(pad, sizeof(pad));
+  inner.update(data, length);
+  ndn::ConstBufferPtr innerDigest = inner.computeDigest();
+
+  for (std::size_t i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = block[i] ^ 0x5c;
+  }
+  ndn::util::Sha256 outer;
+  outer.update(pad, sizeof(pad));
+  outer.update(innerDigest->buf(), innerDigest->size());
+  return outer.computeDigest();
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef SIGNING_POLICY_HPP
+#define SIGNING_POLICY_HPP
+
+#include <inttypes.h>
+#include <vector>
+
+#include <ndn-cxx/data.hpp>
+#include <ndn-cxx/security/key-chain.hpp>
+
+namespace psync {
+
+/**
+ * How each class of Data produced by LogicRepo is signed.
+ *
+ * SIGN_IDENTITY signs with a KeyChain identity (the default identity when
+ * none is named). SIGN_DIGEST_SHA256 only protects integrity and is the
+ * cheapest. SIGN_HMAC_SHA256 authenticates with a key shared inside a
+ * trusted domain.
+ */
+class SigningPolicy
+{
+public:
+  enum PacketClass {
+    PUBLISHED_DATA,
+    HELLO_REPLY, // hello and status replies
+    SYNC_REPLY,  // sync and partial replies
+    NACK_REPLY,  // NACK and MISS replies
+    N_PACKET_CLASSES
+  };
+
+  enum Method {
+    SIGN_IDENTITY,
+    SIGN_DIGEST_SHA256,
+    SIGN_HMAC_SHA256
+  };
+
+  // every class signed with the default identity
+  SigningPolicy();
+
+  /**
+   * Throws std::invalid_argument for SIGN_HMAC_SHA256 before a key is set.
+   */
+  void
+  setMethod(PacketClass packetClass, Method method, const ndn::Name& identity = ndn::Name());
+
+  // key for SIGN_HMAC_SHA256, keyName goes in the KeyLocator
+  void
+  setHmacKey(const ndn::Name& keyName, const std::vector<uint8_t>& key);
+
+  /**
+   * Sign data as configured for its class. Safe to call from several
+   * threads as long as each passes its own KeyChain.
+   */
+  void
+  sign(ndn::Data& data, PacketClass packetClass, ndn::KeyChain& keyChain) const;
+
+  // KeyChain of the calling thread, for signing on worker threads
+  static ndn::KeyChain&
+  threadKeyChain();
+
+private:
+  void
+  signHmac(ndn::Data& data) const;
+
+private:
+  struct Rule
+  {
+    Method method;
+    ndn::Name identity;
+  };
+
+  Rule m_rules[N_PACKET_CLASSES];
+  ndn::Name m_hmacKeyName;
+  std::vector <uint8_t> m_hmacKey;
+};
+
+/**
+ * HMAC-SHA256 (RFC 2104) of data under key.
+ */
+ndn::ConstBufferPtr
+hmacSha256(const uint8_t* key, std::size_t keyLength, const uint8_t* data, std::size_t length);
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include <cassert>
+
+#include "subscription_filter.hpp"
+
+namespace psync {
+
+SubscriptionFilter::SubscriptionFilter()
+: m_nSubscribeAll(0)
+, m_nFilters(0)
+{
+}
+
+void
+SubscriptionFilter::add(const bloom_filter& bf)
+{
+  ++m_nFilters;
+  if (bf.subscribes_all()) {
+    ++m_nSubscribeAll;
+    return;
+  }
+  update(bf, 1);
+}
+
+void
+SubscriptionFilter::remove(const bloom_filter& bf)
+{
+  assert(m_nFilters > 0);
+  --m_nFilters;
+  if (bf.subscribes_all()) {
+    --m_nSubscribeAll;
+    return;
+  }
+  update(bf, -1);
+}
+
+bool
+SubscriptionFilter::mayContain(bloom_key& key) const
+{
+  if (m_nSubscribeAll > 0) {
+    return true;
+  }
+
+  for (auto& s : m_shapes) {
+    const Shape& shape = s.second;
+    bool found = true;
+    for (std::size_t i = 0; i < shape.salts.size() && found; i++) {
+      found = shape.counters[key.hash(shape.hashId, shape.salts[i]) % shape.counters.size()] > 0;
+    }
+    if (found) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+SubscriptionFilter::update(const bloom_filter& bf, int delta)
+{
+  ShapeKey shapeKey(bf.salts().size(), bf.getBitSize(), bf.shape()->hash_id);
+  if (bf.getBitSize() == 0) {
+    return;
+  }
+
+  std::map <ShapeKey, Shape>::iterator it = m_shapes.find(shapeKey);
+  if (it == m_shapes.end()) {
+    assert(delta > 0);
+    Shape shape;
+    shape.salts.assign(bf.salts().begin(), bf.salts().end());
+    shape.hashId = bf.shape()->hash_id;
+    shape.counters.resize(bf.getBitSize(), 0);
+    shape.nFilters = 0;
+    it = m_shapes.insert(std::make_pair(shapeKey, shape)).first;
+  }
+
+  Shape& shape = it->second;
+  const bloom_filter::table_type& table = bf.bit_table();
+  for (std::size_t i = 0; i < table.size(); i++) {
+    if (table[i] == 0)
+      continue;
+    for (std::size_t bit = 0; bit < bits_per_char; bit++) {
+      if (table[i] & bit_mask[bit])
+        shape.counters[i*bits_per_char + bit] += delta;
+    }
+  }
+
+  shape.nFilters += delta;
+  if (shape.nFilters == 0) {
+    m_shapes.erase(it);
+  }
+}
+
+}
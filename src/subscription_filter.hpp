@@ -0,0 +1,62 @@
+#ifndef SUBSCRIPTION_FILTER_HPP
+#define SUBSCRIPTION_FILTER_HPP
+
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "bloom_filter.hpp"
+
+namespace psync {
+
+/**
+ * Counting union of the bloom filters of all pending sync interests.
+ *
+ * Filters are grouped by shape (hash count, table size and hash), since
+ * only filters with the same salts, size and hash can share bit positions. A key
+ * that is in none of the groups has no pending subscriber.
+ */
+class SubscriptionFilter
+{
+public:
+  SubscriptionFilter();
+
+  void
+  add(const bloom_filter& bf);
+
+  void
+  remove(const bloom_filter& bf);
+
+  bool
+  mayContain(bloom_key& key) const;
+
+  bool
+  empty() const
+  {
+    return m_nFilters == 0;
+  }
+
+private:
+  struct Shape
+  {
+    std::vector <uint32_t> salts;
+    uint8_t hashId;
+    std::vector <uint32_t> counters; // one per bit of the filter
+    std::size_t nFilters;
+  };
+
+  typedef std::tuple<std::size_t, unsigned int, uint8_t> ShapeKey; // salt count, bit size, hash
+
+  void
+  update(const bloom_filter& bf, int delta);
+
+private:
+  std::map <ShapeKey, Shape> m_shapes;
+  std::size_t m_nSubscribeAll;
+  std::size_t m_nFilters;
+};
+
+}
+
+#endif
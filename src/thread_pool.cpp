@@ -0,0 +1,96 @@
+#include "thread_pool.hpp"
+
+namespace psync {
+
+// pool and queue index of the calling thread, if it is a worker
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local std::size_t t_index = 0;
+
+ThreadPool::ThreadPool(std::size_t nThreads)
+: m_nextWorker(0)
+, m_nQueued(0)
+, m_stop(false)
+{
+  for (std::size_t i = 0; i < nThreads; i++) {
+    m_workers.emplace_back(new Worker);
+  }
+  for (std::size_t i = 0; i < nThreads; i++) {
+    m_workers[i]->thread = std::thread(&ThreadPool::run, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wakeUp.notify_all();
+
+  for (auto& worker : m_workers) {
+    worker->thread.join();
+  }
+}
+
+void
+ThreadPool::submit(Task task)
+{
+  std::size_t index = t_pool == this ? t_index : m_nextWorker++ % m_workers.size();
+  {
+    std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+    m_workers[index]->tasks.push_back(std::move(task));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_nQueued;
+  }
+  m_wakeUp.notify_one();
+}
+
+bool
+ThreadPool::pop(std::size_t index, Task& task)
+{
+  for (std::size_t i = 0; i < m_workers.size(); i++) {
+    Worker& worker = *m_workers[(index + i) % m_workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty())
+      continue;
+
+    // own queue in order, others' from the back
+    if (i == 0) {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+    }
+    else {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    }
+    --m_nQueued;
+    return true;
+  }
+  return false;
+}
+
+void
+ThreadPool::run(std::size_t index)
+{
+  t_pool = this;
+  t_index = index;
+
+  Task task;
+  while (true) {
+    if (pop(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wakeUp.wait(lock, [this] { return m_stop || m_nQueued > 0; });
+    if (m_stop)
+      return;
+  }
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace psync {
+
+/**
+ * Fixed-size work-stealing thread pool.
+ *
+ * Every worker has its own queue. Tasks submitted from outside the pool
+ * are spread round-robin, tasks submitted by a worker go to its own
+ * queue, and a worker whose queue is empty steals from the back of the
+ * others'.
+ */
+class ThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+  explicit ThreadPool(std::size_t nThreads);
+
+  // queued tasks are dropped, running ones are waited for
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void
+  submit(Task task);
+
+  std::size_t
+  size() const
+  {
+    return m_workers.size();
+  }
+
+private:
+  struct Worker
+  {
+    std::mutex mutex; // guards tasks
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void
+  run(std::size_t index);
+
+  bool
+  pop(std::size_t index, Task& task);
+
+private:
+  std::vector <std::unique_ptr<Worker> > m_workers;
+  std::atomic<std::size_t> m_nextWorker;
+  std::atomic<std::size_t> m_nQueued;
+
+  std::mutex m_mutex; // guards m_stop and sleeping
+  std::condition_variable m_wakeUp;
+  bool m_stop;
+};
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "trace.hpp"
+
+namespace psync {
+namespace trace {
+
+static const size_t RING_SIZE = 1 << 14; // events per thread, power of two
+
+std::atomic<int> g_level(LEVEL_OFF);
+
+/**
+ * Single-producer single-consumer ring owned by one thread and drained by
+ * the writer thread.
+ */
+struct ThreadBuffer
+{
+  ThreadBuffer(uint32_t thread)
+  : thread(thread)
+  , head(0)
+  , tail(0)
+  , dropped(0)
+  {}
+
+  uint32_t thread;
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  std::atomic<uint64_t> dropped;
+  Event events[RING_SIZE];
+};
+
+static std::mutex g_mutex; // guards the fields below
+static std::vector <std::unique_ptr<ThreadBuffer> > g_buffers;
+static FILE* g_file = nullptr;
+static std::thread g_writer;
+static std::atomic<bool> g_running(false);
+
+static thread_local ThreadBuffer* t_buffer = nullptr;
+
+static uint64_t
+readTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static uint64_t
+calibrateTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  auto start = std::chrono::steady_clock::now();
+  uint64_t startTsc = readTsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start).count();
+  return (readTsc() - startTsc) * 1000000000.0 / ns;
+#else
+  return 1000000000;
+#endif
+}
+
+static ThreadBuffer*
+threadBuffer()
+{
+  if (t_buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_buffers.emplace_back(new ThreadBuffer(g_buffers.size()));
+    t_buffer = g_buffers.back().get();
+  }
+  return t_buffer;
+}
+
+void
+record(uint16_t type, uint64_t a, uint64_t b)
+{
+  ThreadBuffer* buffer = threadBuffer();
+  uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  if (head - buffer->tail.load(std::memory_order_acquire) >= RING_SIZE) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Event& event = buffer->events[head & (RING_SIZE - 1)];
+  event.tsc = readTsc();
+  event.type = type;
+  event.reserved = 0;
+  event.thread = buffer->thread;
+  event.a = a;
+  event.b = b;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// caller holds g_mutex
+static void
+drain()
+{
+  for (auto& buffer : g_buffers) {
+    uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      fwrite(&buffer->events[tail & (RING_SIZE - 1)], sizeof(Event), 1, g_file);
+    }
+    buffer->tail.store(tail, std::memory_order_release);
+
+    uint64_t dropped = buffer->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      Event event = {readTsc(), EVENT_DROPPED, 0, buffer->thread, 0, dropped};
+      fwrite(&event, sizeof(Event), 1, g_file);
+    }
+  }
+  fflush(g_file);
+}
+
+bool
+start(const std::string& path, int level)
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  if (g_file != nullptr)
+    return false;
+
+  g_file = fopen(path.c_str(), "wb");
+  if (g_file == nullptr)
+    return false;
+
+  FileHeader header;
+  memcpy(header.magic, "PSTRACE1", sizeof(header.magic));
+  header.tscHz = calibrateTsc();
+  header.startTsc = readTsc();
+  header.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count();
+  fwrite(&header, sizeof(header), 1, g_file);
+
+  g_running = true;
+  g_writer = std::thread([] {
+      while (g_running.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> lock(g_mutex);
+        drain();
+      }
+    });
+
+  g_level = level;
+  return true;
+}
+
+void
+stop()
+{
+  g_level = LEVEL_OFF;
+  if (!g_running.exchange(false))
+    return;
+
+  g_writer.join();
+  std::lock_guard<std::mutex> lock(g_mutex);
+  drain();
+  fclose(g_file);
+  g_file = nullptr;
+}
+
+void
+setLevel(int level)
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  // events are only recorded while a file is open
+  g_level = g_file != nullptr ? level : LEVEL_OFF;
+}
+
+uint64_t
+nameId(const std::string& name)
+{
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < name.size(); i++) {
+    h ^= static_cast<uint8_t>(name[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+void
+defineName(const std::string& name)
+{
+  if (!isEnabled(LEVEL_INFO))
+    return;
+
+  // one event per 8 bytes, zero padded; the decoder concatenates them
+  uint64_t id = nameId(name);
+  for (size_t i = 0; i < name.size(); i += 8) {
+    uint64_t chunk = 0;
+    memcpy(&chunk, name.data() + i, std::min<size_t>(8, name.size() - i));
+    record(EVENT_NAME, id, chunk);
+  }
+}
+
+const char*
+eventName(uint16_t type)
+{
+  switch (type) {
+    case EVENT_NAME:          return "name";
+    case EVENT_PUBLISH:       return "publish";
+    case EVENT_UPDATE_SEQ:    return "update-seq";
+    case EVENT_HELLO:         return "hello";
+    case EVENT_SYNC_INTEREST: return "sync-interest";
+    case EVENT_SYNC_REPLY:    return "sync-reply";
+    case EVENT_PARTIAL:       return "partial";
+    case EVENT_NACK:          return "nack";
+    case EVENT_DIGEST_MISS:   return "digest-miss";
+    case EVENT_DROPPED:       return "dropped";
+    default:                  return "unknown";
+  }
+}
+
+}
+}
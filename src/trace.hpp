@@ -0,0 +1,106 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <inttypes.h>
+#include <atomic>
+#include <string>
+
+// Events above this level are compiled out: 0 none, 1 info, 2 debug
+#ifndef PSYNC_TRACE_LEVEL
+#define PSYNC_TRACE_LEVEL 1
+#endif
+
+#define PSYNC_TRACE(level, type, a, b)                                  \
+  do {                                                                  \
+    if ((level) <= PSYNC_TRACE_LEVEL && ::psync::trace::isEnabled(level)) \
+      ::psync::trace::record((type), (a), (b));                         \
+  } while (false)
+
+namespace psync {
+namespace trace {
+
+enum Level {
+  LEVEL_OFF   = 0,
+  LEVEL_INFO  = 1,
+  LEVEL_DEBUG = 2
+};
+
+enum EventType {
+  EVENT_NAME          = 1,  // a: name id, b: 8 bytes of the name, in order
+  EVENT_PUBLISH       = 2,  // a: prefix id, b: seq
+  EVENT_UPDATE_SEQ    = 3,  // a: prefix id, b: seq
+  EVENT_HELLO         = 4,  // b: reply bytes
+  EVENT_SYNC_INTEREST = 5,  // a: 1 if digest based, 2 a tree node, b: differences found
+  EVENT_SYNC_REPLY    = 6,  // b: reply bytes
+  EVENT_PARTIAL       = 7,  // b: differences recovered
+  EVENT_NACK          = 8,
+  EVENT_DIGEST_MISS   = 9,
+  EVENT_DROPPED       = 10  // b: events lost to full buffers
+};
+
+const char*
+eventName(uint16_t type);
+
+/**
+ * One trace record as stored in the ring buffers and the trace file.
+ */
+struct Event
+{
+  uint64_t tsc;
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t thread;
+  uint64_t a;
+  uint64_t b;
+};
+
+/**
+ * Trace file header; all fields little-endian as written by the host.
+ * Event timestamps convert to wall time as
+ *   startNs + (tsc - startTsc) * 1e9 / tscHz
+ */
+struct FileHeader
+{
+  char magic[8]; // "PSTRACE1"
+  uint64_t startNs;
+  uint64_t startTsc;
+  uint64_t tscHz;
+};
+
+extern std::atomic<int> g_level;
+
+inline bool
+isEnabled(int level)
+{
+  return level <= g_level.load(std::memory_order_relaxed);
+}
+
+/**
+ * Start tracing at the given level into a file. Events are appended to a
+ * fixed-size ring per thread and written out by a background thread.
+ */
+bool
+start(const std::string& path, int level = LEVEL_INFO);
+
+// flush remaining events and close the file
+void
+stop();
+
+void
+setLevel(int level);
+
+void
+record(uint16_t type, uint64_t a, uint64_t b);
+
+// stable 64-bit id for a name, used as event argument
+uint64_t
+nameId(const std::string& name);
+
+// record the text of a name id so the decoder can print it
+void
+defineName(const std::string& name);
+
+}
+}
+
+#endif
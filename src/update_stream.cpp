@@ -0,0 +1,129 @@
+#include "update_stream.hpp"
+
+#include <algorithm>
+
+namespace psync {
+
+UpdateStream::UpdateStream(std::size_t capacity)
+: m_capacity(std::max<std::size_t>(capacity, 1))
+, m_head(0)
+, m_tail(0)
+, m_isDrainPending(false)
+{
+  std::size_t size = 1;
+  while (size < m_capacity) {
+    size *= 2;
+  }
+  m_ring.resize(size);
+}
+
+uint32_t
+UpdateStream::intern(const std::string& prefix)
+{
+  auto it = m_ids.find(prefix);
+  if (it != m_ids.end()) {
+    return it->second;
+  }
+
+  uint32_t id = static_cast<uint32_t>(m_prefixes.size());
+  it = m_ids.insert(std::make_pair(prefix, id)).first;
+  m_prefixes.push_back(&it->first);
+  m_queued.push_back(0);
+  return id;
+}
+
+void
+UpdateStream::push(uint32_t prefixId, uint32_t seq1, uint32_t seq2)
+{
+  // not read yet, the reader gets one record from its first seq1
+  uint64_t queued = m_queued[prefixId];
+  if (queued > m_head) {
+    UpdateRecord& record = m_ring[(queued - 1) & (m_ring.size() - 1)];
+    record.seq2 = std::max(record.seq2, seq2);
+    return;
+  }
+
+  if (size() == m_ring.size()) {
+    grow();
+  }
+  UpdateRecord& record = m_ring[m_tail & (m_ring.size() - 1)];
+  record.prefixId = prefixId;
+  record.seq1 = seq1;
+  record.seq2 = seq2;
+  m_queued[prefixId] = ++m_tail;
+}
+
+bool
+UpdateStream::pop(UpdateRecord& record)
+{
+  if (empty()) {
+    return false;
+  }
+
+  record = m_ring[m_head & (m_ring.size() - 1)];
+  ++m_head;
+  if (m_isDrainPending && size() <= m_capacity / 2) {
+    m_isDrainPending = false;
+    if (m_onDrained) {
+      m_onDrained();
+    }
+  }
+  return true;
+}
+
+std::size_t
+UpdateStream::pop(std::vector<UpdateRecord>& records, std::size_t max)
+{
+  std::size_t n = 0;
+  UpdateRecord record;
+  while (n < max && pop(record)) {
+    records.push_back(record);
+    ++n;
+  }
+  return n;
+}
+
+void
+UpdateStream::await(std::function<void()> onReady)
+{
+  if (!empty()) {
+    onReady();
+    return;
+  }
+  m_onReady = std::move(onReady);
+}
+
+void
+UpdateStream::notify()
+{
+  if (empty() || !m_onReady) {
+    return;
+  }
+  // moved out first, the reader may wait again from inside
+  std::function<void()> onReady = std::move(m_onReady);
+  m_onReady = nullptr;
+  onReady();
+}
+
+bool
+UpdateStream::checkFull()
+{
+  if (size() < m_capacity) {
+    return false;
+  }
+  m_isDrainPending = true;
+  return true;
+}
+
+void
+UpdateStream::grow()
+{
+  // positions stay the same, so the ids' queued positions stay valid
+  std::vector<UpdateRecord> ring(m_ring.size() * 2);
+  for (uint64_t pos = m_head; pos != m_tail; ++pos) {
+    ring[pos & (ring.size() - 1)] = m_ring[pos & (m_ring.size() - 1)];
+  }
+  m_ring.swap(ring);
+}
+
+}
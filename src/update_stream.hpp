@@ -0,0 +1,172 @@
+#ifndef UPDATE_STREAM_HPP
+#define UPDATE_STREAM_HPP
+
+#include <inttypes.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define PSYNC_HAVE_COROUTINES 1
+#endif
+
+namespace psync {
+
+/**
+ * One prefix that advanced from seq1 to seq2, the prefix by its id in
+ * the stream that delivered it.
+ */
+struct UpdateRecord
+{
+  uint32_t prefixId;
+  uint32_t seq1;
+  uint32_t seq2;
+};
+
+/**
+ * Updates of a LogicConsumer for an application that pulls them at its
+ * own pace, instead of taking every reply through an UpdateCallback.
+ *
+ * Records sit in a ring and name their prefix by an id interned once per
+ * prefix, so delivering one copies no strings. A prefix that advances
+ * again before it is read updates its queued record instead of taking
+ * another. Once the stream holds capacity records the consumer stops
+ * sending sync interests, and sends them again when the reader has
+ * drained it to half. The reply of an interest already sent still comes
+ * in, the ring grows for it if it must.
+ *
+ * Not thread-safe, read on the thread of the consumer's face.
+ */
+class UpdateStream
+{
+public:
+  explicit UpdateStream(std::size_t capacity);
+
+  UpdateStream(const UpdateStream&) = delete;
+  UpdateStream& operator=(const UpdateStream&) = delete;
+
+  // id of prefix, the same for as long as the stream lives
+  uint32_t
+  intern(const std::string& prefix);
+
+  const std::string&
+  getPrefix(uint32_t prefixId) const
+  {
+    return *m_prefixes[prefixId];
+  }
+
+  void
+  push(uint32_t prefixId, uint32_t seq1, uint32_t seq2);
+
+  // the oldest record, false if there is none
+  bool
+  pop(UpdateRecord& record);
+
+  // append up to max records to records, returns how many
+  std::size_t
+  pop(std::vector<UpdateRecord>& records, std::size_t max);
+
+  /**
+   * Call onReady once the stream has records: right away if it has,
+   * else after the next reply that adds some. One reader waits at a
+   * time, a later call replaces the earlier one.
+   */
+  void
+  await(std::function<void()> onReady);
+
+  // wake the reader, once the records of a reply are all pushed
+  void
+  notify();
+
+  /**
+   * True if the stream holds capacity records or more. The drain
+   * callback then runs once, when the reader brings it down to half.
+   */
+  bool
+  checkFull();
+
+  void
+  setOnDrained(std::function<void()> onDrained)
+  {
+    m_onDrained = std::move(onDrained);
+  }
+
+  std::size_t
+  size() const
+  {
+    return static_cast<std::size_t>(m_tail - m_head);
+  }
+
+  bool
+  empty() const
+  {
+    return m_tail == m_head;
+  }
+
+  std::size_t
+  capacity() const
+  {
+    return m_capacity;
+  }
+
+#ifdef PSYNC_HAVE_COROUTINES
+  struct Next
+  {
+    bool
+    await_ready() const
+    {
+      return !stream.empty();
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle)
+    {
+      stream.await([handle] { handle.resume(); });
+    }
+
+    UpdateRecord
+    await_resume()
+    {
+      UpdateRecord record;
+      stream.pop(record);
+      return record;
+    }
+
+    UpdateStream& stream;
+  };
+
+  /**
+   * co_await stream.next() gives the oldest record, suspending until
+   * there is one. The coroutine resumes on the face's thread, inside
+   * the consumer's handling of the reply.
+   */
+  Next
+  next()
+  {
+    return Next{*this};
+  }
+#endif
+
+private:
+  void
+  grow();
+
+private:
+  std::size_t m_capacity;
+  std::vector<UpdateRecord> m_ring; // power of two, indexed by position & mask
+  uint64_t m_head; // position of the oldest record
+  uint64_t m_tail; // position after the newest record
+  std::unordered_map<std::string, uint32_t> m_ids;
+  std::vector<const std::string*> m_prefixes; // keys of m_ids by id
+  std::vector<uint64_t> m_queued; // by id, position + 1 of its record, stale once read
+  std::function<void()> m_onReady;
+  std::function<void()> m_onDrained;
+  bool m_isDrainPending;
+};
+
+}
+
+#endif
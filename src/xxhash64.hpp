@@ -0,0 +1,18 @@
+#ifndef XXHASH64_HPP
+#define XXHASH64_HPP
+
+#include <inttypes.h>
+#include <cstddef>
+
+namespace psync {
+
+/**
+ * XXH64 of xxHash (BSD 2-clause, Yann Collet), 64-bit output, 32 bytes
+ * per round. Reads input as little-endian, so it is the same on every
+ * host.
+ */
+uint64_t XXH64(const uint8_t* data, size_t len, uint64_t seed);
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ndn-cxx/encoding/block-helpers.hpp>
+#include <ndn-cxx/util/dummy-client-face.hpp>
+#include <ndn-cxx/util/scheduler.hpp>
+
+#include "bloom_filter.hpp"
+#include "forwarder.hpp"
+#include "logic_consumer.hpp"
+#include "logic_repo.hpp"
+
+namespace psync {
+
+namespace time = ndn::time;
+
+static const std::size_t N_PRODUCERS = 100;
+static const std::size_t EXPECTED_ENTRIES = 20;
+
+static std::string
+producerName(std::size_t i)
+{
+  return "/test/producer-" + std::to_string(i);
+}
+
+// Fewest producers advancing once whose difference to the state where
+// none did peels only in part with IBLTs of expectedEntries, recovering
+// some but not all of the new keys, 0 if none.
+static std::size_t
+findPartialPeel(std::size_t expectedEntries)
+{
+  for (std::size_t nAdvanced = 1; nAdvanced <= N_PRODUCERS; nAdvanced++) {
+    IBLT before(expectedEntries);
+    IBLT after(expectedEntries);
+    for (std::size_t i = 0; i < N_PRODUCERS; i++) {
+      before.insert(IBLT::makeKey(producerName(i) + "/1"));
+      after.insert(IBLT::makeKey(producerName(i) + (i < nAdvanced ? "/2" : "/1")));
+    }
+    after -= before;
+    std::set<IBLT::Key> positive;
+    std::set<IBLT::Key> negative;
+    if (!after.listEntries(positive, negative) &&
+        !positive.empty() && positive.size() < nAdvanced) {
+      return nAdvanced;
+    }
+  }
+  return 0;
+}
+
+// Sync interest with the empty IBLT and a bloom filter for one
+// subscription at 0.001, whose table has tableSize bytes.
+static ndn::Name
+makeSyncName(const ndn::Name& syncPrefix, std::size_t tableSize)
+{
+  std::shared_ptr<const bloom_shape> shape = bloom_shape::get(1, 1);
+  std::vector<uint8_t> bf(tableSize, 0xff);
+  std::vector<uint8_t> iblt = IBLT(EXPECTED_ENTRIES).encode();
+
+  ndn::Name name(syncPrefix);
+  name.append("sync");
+  name.appendNumber(shape->hash_id).appendNumber(1).appendNumber(1);
+  name.appendNumber(bf.size()).append(bf.data(), bf.size());
+  name.appendNumber(iblt.size()).append(iblt.data(), iblt.size());
+  return name;
+}
+
+class RepoConsumerFixture
+{
+public:
+  RepoConsumerFixture()
+  : scheduler(ioService)
+  , forwarder(scheduler, time::milliseconds(1), 0, 1)
+  , repoFace(ioService, {false, false})
+  , consumerFace(ioService, {false, false})
+  , syncPrefix("/test/sync")
+  , isHelloDone(false)
+  {
+    forwarder.addFace(repoFace);
+    forwarder.addFace(consumerFace);
+    forwarder.addRoute("/test", repoFace);
+  }
+
+  void
+  advance(time::milliseconds duration)
+  {
+    scheduler.scheduleEvent(duration, [this] { ioService.stop(); });
+    ioService.run();
+    ioService.reset();
+  }
+
+public:
+  boost::asio::io_service ioService;
+  ndn::Scheduler scheduler;
+  sim::SimForwarder forwarder;
+  ndn::util::DummyClientFace repoFace;
+  ndn::util::DummyClientFace consumerFace;
+  ndn::Name syncPrefix;
+  bool isHelloDone;
+};
+
+BOOST_FIXTURE_TEST_SUITE(TestLogicRepo, RepoConsumerFixture)
+
+BOOST_AUTO_TEST_CASE(StalledPeelDeliversRecoveredPrefixes)
+{
+  std::size_t nAdvanced = findPartialPeel(EXPECTED_ENTRIES);
+  BOOST_REQUIRE_GT(nAdvanced, 0);
+
+  LogicRepo repo(EXPECTED_ENTRIES, repoFace, syncPrefix,
+                 time::milliseconds(1000), time::milliseconds(1000));
+  // no digest catch-up, consumers send their IBLT every round
+  repo.setHistorySize(0);
+  for (std::size_t i = 0; i < N_PRODUCERS; i++) {
+    repo.addSyncNode(producerName(i));
+    repo.updateSeq(producerName(i), 1);
+  }
+
+  RecieveHelloCallback onHello = [this] { isHelloDone = true; };
+  std::vector<std::size_t> batches;
+  UpdateCallback onUpdate = [&] (const std::vector<MissingData>& updates) {
+    batches.push_back(updates.size());
+  };
+  // one subscription at 0.001 subscribes to everything
+  LogicConsumer consumer(syncPrefix, consumerFace, onHello, onUpdate, 1, 0.001);
+  consumer.sendHelloInterest();
+  advance(time::milliseconds(100));
+  BOOST_REQUIRE(isHelloDone);
+
+  // the consumer falls further behind than its IBLT covers
+  for (std::size_t i = 0; i < nAdvanced; i++) {
+    repo.updateSeq(producerName(i), 2);
+  }
+  consumer.sendSyncInterest();
+  advance(time::milliseconds(100));
+
+  // the partial reply carries only what peeled, the remainder does not
+  // peel on its own and comes with the hello after the NACK
+  BOOST_REQUIRE_EQUAL(batches.size(), 2);
+  BOOST_CHECK_GT(batches[0], 0);
+  BOOST_CHECK_LT(batches[0], nAdvanced);
+  BOOST_CHECK_EQUAL(batches[0] + batches[1], nAdvanced);
+
+  MetricsSnapshot metrics = consumer.getMetrics();
+  BOOST_CHECK_EQUAL(metrics.counters["partial_replies"], 1);
+  BOOST_CHECK_EQUAL(metrics.counters["nacks"], 1);
+  BOOST_CHECK_EQUAL(metrics.counters["hello_sent"], 2);
+  for (std::size_t i = 0; i < N_PRODUCERS; i++) {
+    BOOST_CHECK_EQUAL(consumer.getSeq(producerName(i)), i < nAdvanced ? 2 : 1);
+  }
+  // caught up, the next round waits at the repo
+  BOOST_CHECK_EQUAL(repo.getMetrics().counters["pending_entries"], 1);
+}
+
+BOOST_AUTO_TEST_CASE(MalformedFilterIsNacked)
+{
+  LogicRepo repo(EXPECTED_ENTRIES, repoFace, syncPrefix,
+                 time::milliseconds(1000), time::milliseconds(1000));
+  std::size_t tableSize = bloom_shape::get(1, 1)->raw_table_size;
+
+  std::vector<std::string> replies;
+  for (std::size_t size : {tableSize - 1, tableSize + 8}) {
+    ndn::Interest interest(makeSyncName(syncPrefix, size));
+    interest.setInterestLifetime(time::milliseconds(1000));
+    consumerFace.expressInterest(interest,
+                                 [&] (const ndn::Interest&, const ndn::Data& data) {
+                                   const ndn::Block& content = data.getContent();
+                                   replies.push_back(std::string(
+                                     reinterpret_cast<const char*>(content.value()),
+                                     content.value_size()));
+                                 },
+                                 [] (const ndn::Interest&) {});
+  }
+  advance(time::milliseconds(100));
+
+  // truncated and oversized, neither reaches the subscription counters
+  BOOST_REQUIRE_EQUAL(replies.size(), 2);
+  BOOST_CHECK_EQUAL(replies[0], "NACK 0");
+  BOOST_CHECK_EQUAL(replies[1], "NACK 0");
+  BOOST_CHECK_EQUAL(repo.getMetrics().counters["pending_entries"], 0);
+
+  // the same interest with the right size waits for a change
+  ndn::Interest interest(makeSyncName(syncPrefix, tableSize));
+  interest.setInterestLifetime(time::milliseconds(1000));
+  consumerFace.expressInterest(interest,
+                               [] (const ndn::Interest&, const ndn::Data&) {},
+                               [] (const ndn::Interest&) {});
+  advance(time::milliseconds(100));
+  BOOST_CHECK_EQUAL(repo.getMetrics().counters["pending_entries"], 1);
+}
+
+BOOST_AUTO_TEST_CASE(ReplicaConvergesWithoutPublications)
+{
+  LogicRepo repo(EXPECTED_ENTRIES, repoFace, syncPrefix,
+                 time::milliseconds(1000), time::milliseconds(1000));
+  // advanced without publishing, or loaded, so no peer has their Data
+  std::vector<std::pair<std::string, uint32_t> > table;
+  for (std::size_t i = 0; i < N_PRODUCERS; i++) {
+    if (i % 2 == 0) {
+      repo.addSyncNode(producerName(i));
+      repo.updateSeq(producerName(i), 3);
+    }
+    else {
+      table.push_back(std::make_pair(producerName(i), 2));
+    }
+  }
+  repo.bulkLoad(table);
+
+  ndn::Name replicaPrefix("/replica/sync");
+  forwarder.addRoute("/replica", consumerFace);
+  LogicRepo replica(EXPECTED_ENTRIES, consumerFace, replicaPrefix,
+                    time::milliseconds(1000), time::milliseconds(1000));
+  replica.addReplica(syncPrefix);
+  // every fetch gets an empty reply and is retried before it is given up on
+  advance(time::milliseconds(5000));
+
+  for (std::size_t i = 0; i < N_PRODUCERS; i++) {
+    BOOST_CHECK_EQUAL(replica.getSeq(producerName(i)), i % 2 == 0 ? 3 : 2);
+  }
+  MetricsSnapshot metrics = replica.getMetrics();
+  BOOST_CHECK_EQUAL(metrics.counters["replica_fetches"], 0);
+  BOOST_CHECK_EQUAL(metrics.counters["replica_fetch_misses"], N_PRODUCERS / 2 * 5);
+  BOOST_CHECK_EQUAL(metrics.counters["replica_fetch_names"], 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
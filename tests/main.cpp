@@ -0,0 +1,4 @@
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_MODULE PartialSync Tests
+
+#include <boost/test/unit_test.hpp>
@@ -0,0 +1,48 @@
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include "signing_policy.hpp"
+
+namespace psync {
+
+static std::string
+toHex(const ndn::ConstBufferPtr& buffer)
+{
+  static const char DIGITS[] = "0123456789abcdef";
+  std::string hex;
+  for (std::size_t i = 0; i < buffer->size(); i++) {
+    hex += DIGITS[buffer->buf()[i] >> 4];
+    hex += DIGITS[buffer->buf()[i] & 0xf];
+  }
+  return hex;
+}
+
+static std::string
+hmacHex(const std::vector<uint8_t>& key, const std::string& data)
+{
+  return toHex(hmacSha256(key.data(), key.size(),
+                          reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+}
+
+BOOST_AUTO_TEST_SUITE(TestSigningPolicy)
+
+// RFC 4231 test cases 1, 2 and 6, the last with a key longer than a block
+BOOST_AUTO_TEST_CASE(HmacSha256Rfc4231)
+{
+  BOOST_CHECK_EQUAL(hmacHex(std::vector<uint8_t>(20, 0x0b), "Hi There"),
+                    "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+  std::string jefe = "Jefe";
+  BOOST_CHECK_EQUAL(hmacHex(std::vector<uint8_t>(jefe.begin(), jefe.end()),
+                            "what do ya want for nothing?"),
+                    "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+  BOOST_CHECK_EQUAL(hmacHex(std::vector<uint8_t>(131, 0xaa),
+                            "Test Using Larger Than Block-Size Key - Hash Key First"),
+                    "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}
@@ -0,0 +1,68 @@
+// Print a binary trace written by psync::trace as text, one event per line:
+//   <wall time> <thread> <event> <arguments>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "trace.hpp"
+
+using namespace psync::trace;
+
+int
+main(int argc, char** argv)
+{
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " <trace file>" << std::endl;
+    return 2;
+  }
+
+  FILE* file = fopen(argv[1], "rb");
+  if (file == nullptr) {
+    std::cerr << "cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  FileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, "PSTRACE1", sizeof(header.magic)) != 0) {
+    std::cerr << "not a PartialSync trace" << std::endl;
+    return 1;
+  }
+
+  std::map <uint64_t, std::string> names;
+  Event event;
+  while (fread(&event, sizeof(event), 1, file) == 1) {
+    if (event.type == EVENT_NAME) {
+      char chunk[9] = {0};
+      memcpy(chunk, &event.b, 8);
+      names[event.a] += chunk;
+      continue;
+    }
+
+    double offset = (static_cast<double>(event.tsc) - header.startTsc) / header.tscHz;
+    uint64_t ns = header.startNs + static_cast<int64_t>(offset * 1e9);
+    time_t seconds = ns / 1000000000;
+    char wall[32];
+    strftime(wall, sizeof(wall), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+    printf("%s.%06u %u %s", wall, static_cast<unsigned>(ns % 1000000000 / 1000),
+           event.thread, eventName(event.type));
+
+    if (event.type == EVENT_PUBLISH || event.type == EVENT_UPDATE_SEQ) {
+      auto name = names.find(event.a);
+      if (name != names.end())
+        printf(" %s/%" PRIu64 "\n", name->second.c_str(), event.b);
+      else
+        printf(" %016" PRIx64 "/%" PRIu64 "\n", event.a, event.b);
+    }
+    else {
+      printf(" %" PRIu64 " %" PRIu64 "\n", event.a, event.b);
+    }
+  }
+
+  fclose(file);
+  return 0;
+}